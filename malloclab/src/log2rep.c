@@ -0,0 +1,321 @@
+/*
+ * log2rep.c - turn mmtrace logs into a malloc lab tracefile
+ *
+ * Merges the per-thread logs that libmmtrace.so wrote for a process
+ * (see mmtrace.c) by call order, gives every block an id for as long
+ * as it lives, and writes the requests as a .rep file, or with -b as
+ * a binary trace (see tracebin.h). Calls that mdriver cannot replay
+ * are mapped onto ones it can: a request for 0 bytes asks for 1,
+ * realloc(NULL, n) is a malloc and realloc(p, 0) a free. Frees of blocks that were not logged are dropped, and blocks
+ * still live at the end are freed, so the trace is balanced. realloc is
+ * ordered by when it was called, so the block it returns may still be
+ * live in the logs, released by another thread's free or realloc just
+ * after; that call is moved up to where the block comes back, or if
+ * none is found the old block simply ends there.
+ *
+ * usage: log2rep [-b] out.rep log...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "mmtrace.h"
+#include "tracebin.h"
+
+#define RACE_WINDOW 1024   /* records searched for a release that lost a race */
+#define MOVED       UINT32_MAX  /* type of a record converted ahead of its turn */
+
+/* a live block, in a chained hash table keyed by address */
+typedef struct block_t {
+    uint64_t ptr;
+    int id;
+    struct block_t *next;
+} block_t;
+
+static mmtrace_rec_t *recs;
+static size_t num_recs = 0;
+static size_t cur = 0;      /* record being converted */
+
+static tracebin_op_t *ops;
+static int num_ops = 0, max_ops = 0;
+static int num_ids = 0;
+static long long heap_hint = 0;
+
+static block_t **table;
+static size_t table_size = 1 << 16;
+static size_t num_live = 0;
+
+static void convert(mmtrace_rec_t *r);
+
+static void *xmalloc(size_t size)
+{
+    void *p;
+
+    if ((p = malloc(size)) == NULL) {
+        fprintf(stderr, "log2rep: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static void read_log(char *path)
+{
+    FILE *fp;
+    long len;
+
+    if ((fp = fopen(path, "r")) == NULL || fseek(fp, 0, SEEK_END) < 0 ||
+        (len = ftell(fp)) < 0) {
+        perror(path);
+        exit(1);
+    }
+    if (len % sizeof(mmtrace_rec_t) != 0)
+        fprintf(stderr, "log2rep: %s: ignoring a partial record\n", path);
+    rewind(fp);
+    recs = realloc(recs, (num_recs + len / sizeof(mmtrace_rec_t) + 1) *
+                   sizeof(mmtrace_rec_t));
+    if (recs == NULL) {
+        fprintf(stderr, "log2rep: out of memory\n");
+        exit(1);
+    }
+    num_recs += fread(recs + num_recs, sizeof(mmtrace_rec_t),
+                      len / sizeof(mmtrace_rec_t), fp);
+    fclose(fp);
+}
+
+static int by_seq(const void *a, const void *b)
+{
+    uint64_t x = ((mmtrace_rec_t *)a)->seq, y = ((mmtrace_rec_t *)b)->seq;
+
+    return x < y ? -1 : x > y;
+}
+
+static size_t hash(uint64_t ptr)
+{
+    return (ptr >> 4) * 0x9e3779b97f4a7c15ULL >> 20 & (table_size - 1);
+}
+
+/* lookup - the slot holding ptr's block, or the empty slot at its chain's end */
+static block_t **lookup(uint64_t ptr)
+{
+    block_t **bp;
+
+    for (bp = &table[hash(ptr)]; *bp && (*bp)->ptr != ptr; bp = &(*bp)->next)
+        ;
+    return bp;
+}
+
+static void grow_table(void)
+{
+    block_t **old = table, *b, *next;
+    size_t i, old_size = table_size;
+
+    table_size *= 2;
+    table = calloc(table_size, sizeof(block_t *));
+    if (table == NULL) {
+        fprintf(stderr, "log2rep: out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < old_size; i++)
+        for (b = old[i]; b; b = next) {
+            next = b->next;
+            b->next = table[hash(b->ptr)];
+            table[hash(b->ptr)] = b;
+        }
+    free(old);
+}
+
+static void emit(int type, int id, uint64_t size)
+{
+    if (num_ops == max_ops) {
+        max_ops = max_ops ? 2 * max_ops : 1 << 16;
+        ops = realloc(ops, max_ops * sizeof(tracebin_op_t));
+        if (ops == NULL) {
+            fprintf(stderr, "log2rep: out of memory\n");
+            exit(1);
+        }
+    }
+    if (size == 0 && type != TRACEBIN_FREE)
+        size = 1;
+    if (size > INT_MAX) {
+        fprintf(stderr, "log2rep: request %d: %llu bytes is too large\n",
+                num_ops, (unsigned long long)size);
+        exit(1);
+    }
+    ops[num_ops].type = type;
+    ops[num_ops].index = id;
+    ops[num_ops].size = size;
+    num_ops++;
+    heap_hint += size;
+}
+
+/* take - remove ptr's block from the table and return its id, or -1 */
+static int take(uint64_t ptr)
+{
+    block_t **bp = lookup(ptr), *b = *bp;
+    int id;
+
+    if (b == NULL)
+        return -1;
+    id = b->id;
+    *bp = b->next;
+    free(b);
+    num_live--;
+    return id;
+}
+
+/* pending_release - a free or realloc of ptr logged shortly after the current record */
+static mmtrace_rec_t *pending_release(uint64_t ptr)
+{
+    mmtrace_rec_t *r;
+    size_t i;
+
+    for (i = cur + 1; i < num_recs && i <= cur + RACE_WINDOW; i++) {
+        r = &recs[i];
+        if ((r->type == MMTRACE_FREE && r->ptr == ptr) ||
+            (r->type == MMTRACE_REALLOC && r->old == ptr))
+            return r;
+        if (r->type != MMTRACE_FREE && r->ptr == ptr)
+            break;
+    }
+    return NULL;
+}
+
+/* give - enter ptr as the block id, ending any block still there */
+static void give(uint64_t ptr, int id)
+{
+    mmtrace_rec_t *r, early;
+    block_t *b;
+    int old;
+
+    if (*lookup(ptr) && (r = pending_release(ptr)) != NULL) {
+        early = *r;
+        r->type = MOVED;
+        convert(&early);
+    }
+    if ((old = take(ptr)) >= 0)
+        emit(TRACEBIN_FREE, old, 0);
+    if (num_live >= table_size)
+        grow_table();
+    b = xmalloc(sizeof(block_t));
+    b->ptr = ptr;
+    b->id = id;
+    b->next = table[hash(ptr)];
+    table[hash(ptr)] = b;
+    num_live++;
+}
+
+static void convert(mmtrace_rec_t *r)
+{
+    int id;
+
+    switch (r->type) {
+    case MMTRACE_MALLOC:
+    case MMTRACE_CALLOC:
+        give(r->ptr, num_ids);
+        emit(r->type == MMTRACE_CALLOC ? TRACEBIN_CALLOC : TRACEBIN_ALLOC,
+             num_ids++, r->size);
+        break;
+    case MMTRACE_FREE:
+        if ((id = take(r->ptr)) >= 0)
+            emit(TRACEBIN_FREE, id, 0);
+        break;
+    case MMTRACE_REALLOC:
+        id = r->old ? take(r->old) : -1;
+        if (r->ptr == 0) {             /* realloc(p, 0) freed p */
+            if (id >= 0)
+                emit(TRACEBIN_FREE, id, 0);
+        } else if (id < 0) {           /* realloc(NULL, n), or of an unlogged block */
+            give(r->ptr, num_ids);
+            emit(TRACEBIN_ALLOC, num_ids++, r->size);
+        } else {
+            give(r->ptr, id);
+            emit(TRACEBIN_REALLOC, id, r->size);
+        }
+        break;
+    case MOVED:
+        break;
+    default:
+        fprintf(stderr, "log2rep: bogus record type %u\n", r->type);
+        exit(1);
+    }
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: log2rep [-b] out.rep log...\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    FILE *out;
+    tracebin_hdr_t hdr;
+    block_t *b, *next;
+    size_t i;
+    int c, binary = 0;
+
+    while ((c = getopt(argc, argv, "b")) != EOF) {
+        if (c == 'b')
+            binary = 1;
+        else
+            usage();
+    }
+    if (argc - optind < 2)
+        usage();
+
+    for (c = optind + 1; c < argc; c++)
+        read_log(argv[c]);
+    qsort(recs, num_recs, sizeof(mmtrace_rec_t), by_seq);
+
+    table = calloc(table_size, sizeof(block_t *));
+    if (table == NULL) {
+        fprintf(stderr, "log2rep: out of memory\n");
+        exit(1);
+    }
+    for (cur = 0; cur < num_recs; cur++)
+        convert(&recs[cur]);
+    for (i = 0; i < table_size; i++)
+        for (b = table[i]; b; b = next) {
+            next = b->next;
+            emit(TRACEBIN_FREE, b->id, 0);
+            free(b);
+        }
+    if (num_ids == 0) {
+        fprintf(stderr, "log2rep: no blocks in the logs\n");
+        exit(1);
+    }
+
+    if ((out = fopen(argv[optind], "w")) == NULL) {
+        perror(argv[optind]);
+        exit(1);
+    }
+    hdr.magic = TRACEBIN_MAGIC;
+    hdr.version = TRACEBIN_VERSION;
+    hdr.sugg_heapsize = heap_hint > INT_MAX ? INT_MAX : heap_hint;
+    hdr.num_ids = num_ids;
+    hdr.num_ops = num_ops;
+    hdr.weight = 1;
+    if (binary) {
+        fwrite(&hdr, sizeof(hdr), 1, out);
+        tracebin_write(out, ops, num_ops);
+    } else {
+        fprintf(out, "%d\n%d\n%d\n%d\n", hdr.sugg_heapsize, hdr.num_ids,
+                hdr.num_ops, hdr.weight);
+        for (c = 0; c < num_ops; c++) {
+            if (ops[c].type == TRACEBIN_FREE)
+                fprintf(out, "f %d\n", ops[c].index);
+            else
+                fprintf(out, "%c %d %d\n", "afrbc"[ops[c].type],
+                        ops[c].index, ops[c].size);
+        }
+    }
+    if (ferror(out) || fclose(out) != 0) {
+        perror(argv[optind]);
+        exit(1);
+    }
+    fprintf(stderr, "log2rep: %zu calls, %d requests on %d blocks\n",
+            num_recs, num_ops, num_ids);
+    return 0;
+}
@@ -14,12 +14,27 @@
 #include <string.h>
 #include <assert.h>
 #include <float.h>
+#include <stdint.h>
 #include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
 #include "config.h"
+#include "tracebin.h"
 
 /**********************
  * Constants and macros
@@ -30,26 +45,67 @@
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
+/* Multithreaded replay */
+#define MAX_THREADS 64   /* most threads in one replay */
+#define MT_REPS      3   /* replays per thread count, the fastest counts */
+
+/* Latency histograms: LAT_SUB buckets per power of two up to 2^63 */
+#define LAT_SUB     16
+#define LAT_BUCKETS (61 * LAT_SUB)
+#define LAT_REPS    10   /* replays of each trace for the histograms */
+#if defined(__i386__) || defined(__x86_64__)
+#define LAT_UNIT    "cycles"
+#else
+#define LAT_UNIT    "ns"
+#endif
+
+/* Heap walk samples (-s): free block sizes by powers of four, map width */
+#define FRAG_BUCKETS 8
+#define MAP_WIDTH   64
+
+/* Performance counters read around one extra speed run of each trace */
+#define NUM_EVENTS   7
+
+/* Skip list of payload ranges: each level holds 1/RANGE_FANOUT of the last */
+#define RANGE_LEVELS 16
+#define RANGE_FANOUT  4
+
 /* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
+#define IS_ALIGNED(p)  ((((uintptr_t)(p)) % ALIGNMENT) == 0)
 
 /****************************** 
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/*
+ * Records the extent of each block's payload. The ranges of a trace
+ * form a skip list sorted by lo, headed by a range with all levels.
+ */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    int levels;            /* number of lists this range is on */
+    struct range_t *next[];/* next list element on each level */
 } range_t;
 
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
+    enum {ALLOC = TRACEBIN_ALLOC, FREE = TRACEBIN_FREE,
+	  REALLOC = TRACEBIN_REALLOC, BATCH = TRACEBIN_BATCH,
+	  CALLOC = TRACEBIN_CALLOC, FREE_SIZED = TRACEBIN_FREE_SIZED,
+	  MEMALIGN = TRACEBIN_MEMALIGN} type; /* type of request */
+    int index;                        /* index for free() to use later;
+					 for BATCH, the requests it covers;
+					 for MEMALIGN, the alignment */
+    int size;                         /* byte size of alloc/realloc/calloc
+					 request, or of the block a sized
+					 free frees */
 } traceop_t;
+#define NUM_TYPES (MEMALIGN + 1)
+
+/* The requests of a binary trace are decoded straight into ops */
+_Static_assert(sizeof(traceop_t) == sizeof(tracebin_op_t),
+	       "traceop_t does not match the binary trace format");
 
 /* Holds the information for one trace file*/
 typedef struct {
@@ -60,6 +116,9 @@ typedef struct {
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    int num_batches;     /* number of BATCH requests among the ops */
+    int num_markers;     /* BATCH and MEMALIGN requests, which are not counted */
+    void **batch;        /* room for the pointers of the largest batch */
 } trace_t;
 
 /* 
@@ -72,6 +131,21 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/* One thread's share of a trace in the multithreaded replay */
+typedef struct {
+    trace_t *trace;
+    int *ops;        /* indices of this thread's requests, in trace order */
+    int num_ops;
+    struct timeval start;   /* when the thread started replaying */
+} stream_t;
+
+/* Latencies of one type of request, in ticks of read_ticks() */
+typedef struct {
+    unsigned long count[LAT_BUCKETS];
+    unsigned long n;
+    unsigned long long max;
+} hist_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
@@ -81,6 +155,19 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    size_t peak;     /* largest heap size during the util run */
+    size_t heap;     /* heap size at the end of the util run */
+    size_t resident; /* heap bytes still resident at the end of the util run */
+
+    /* defined only with -L, for both packages */
+    hist_t *lat;     /* latency histograms, indexed by request type */
+
+    /* defined only with -C, for both packages; -1 if not counted */
+    long long events[NUM_EVENTS]; /* counter deltas over one speed run */
+
+    /* defined only with -B, for the student malloc package */
+    int batches;     /* number of batches in the trace */
+    double loop_secs;/* secs with each batch replayed one request at a time */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
@@ -95,6 +182,45 @@ char msg[MAXLINE];      /* for whenever we need to compose an error message */
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
+/* 
+ * Multithreaded replay (-T): the thread counts to run, whether each
+ * block is freed by the thread after the one that allocated it (-P),
+ * and the progress that such a free waits for
+ */
+static int mt_threads[MAX_THREADS];
+static int mt_counts = 0;
+static int mt_handoff = 0;
+static int mt_libc;          /* replaying against libc malloc */
+static int *mt_need;         /* per request: requests on its id before it */
+static int *mt_done;         /* per id: requests done so far */
+static pthread_barrier_t mt_barrier;
+
+/* Per-request latencies (-L), optionally written out as CSV (-c) */
+static int latency = 0;
+static char *latency_csv = NULL;
+static unsigned long long tick_overhead;  /* cost of one read_ticks() pair */
+static char *op_names[NUM_TYPES] = {"malloc", "free", "realloc", "batch",
+				    "calloc", "free_sized", "memalign"};
+
+/* Performance counters (-C) */
+static int counters = 0;
+static char *event_names[NUM_EVENTS] = {
+    "cycles", "instrs", "L1D miss", "LLC miss", "br miss", "dTLB miss", "faults"
+};
+
+/* Heap walks every sample_every requests of the util run (-s) */
+static int sample_every = 0;
+static char *sample_base = "heapwalk";  /* of the .csv and .map files (-o) */
+static FILE *sample_csv, *sample_map;
+
+/*
+ * Batches of requests (see tracebin.h) are replayed with mm_malloc_batch
+ * and mm_free_batch, except while -B times the same trace one request
+ * at a time
+ */
+static int batch_calls = 1;
+static int batch_bench = 0;
+
 /* The filenames of the default tracefiles */
 static char *default_tracefiles[] = {  
     DEFAULT_TRACEFILES, NULL
@@ -110,14 +236,19 @@ static int add_range(range_t **ranges, char *lo, int size,
 		     int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static range_t *new_range(int levels);
+static void find_range(range_t *head, char *lo, range_t **prev);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static void map_trace(trace_t *trace, FILE *tracefile, char *path);
+static void check_trace(trace_t *trace, char *path);
 static void free_trace(trace_t *trace);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
 static void eval_libc_speed(void *ptr);
+static void *libc_memalign(size_t alignment, size_t size);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
@@ -125,8 +256,32 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
 
+/* per-request latency histograms, for mm and libc */
+static unsigned long long read_ticks(void);
+static void init_ticks(void);
+static void hist_add(hist_t *hist, unsigned long long ticks);
+static unsigned long long hist_quantile(hist_t *hist, double q);
+static hist_t *eval_latency(trace_t *trace, int libc);
+static void printlatency(int n, stats_t *stats);
+static void dumplatency(FILE *fp, char *package, int n, stats_t *stats);
+
+/* fragmentation over time, from walks of the mm heap */
+static void sample_heap(trace_t *trace, int tracenum, int opnum, int live);
+
+/* hardware performance counters, for mm and libc */
+static void count_events(fsecs_test_funct f, void *argp, long long *events);
+static void printevents(int n, stats_t *stats, int per_op);
+
+/* multithreaded replay of the tracefiles, for mm and libc */
+static void split_trace(trace_t *trace, int nthreads, stream_t *streams);
+static void *mt_worker(void *vargp);
+static double eval_mt(trace_t *trace, int nthreads, int libc);
+static void run_mt(char **tracefiles, int num_tracefiles, int run_libc);
+
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printmemory(int n, stats_t *stats);
+static void printbatches(int n, stats_t *stats);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -158,7 +313,9 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    char *arg;
+
+    while ((c = getopt(argc, argv, "f:t:T:PLc:Cs:o:BhvVgal")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -184,6 +341,38 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+	case 'T': /* Replay the traces on these numbers of threads, too */
+	    for (arg = strtok(optarg, ","); arg != NULL; arg = strtok(NULL, ",")) {
+		if (mt_counts == MAX_THREADS || atoi(arg) < 1 || atoi(arg) > MAX_THREADS) {
+		    usage();
+		    exit(1);
+		}
+		mt_threads[mt_counts++] = atoi(arg);
+	    }
+	    break;
+	case 'P': /* In that replay, free blocks on another thread */
+	    mt_handoff = 1;
+	    break;
+	case 'L': /* Time every request and print latency percentiles */
+	    latency = 1;
+	    break;
+	case 'c': /* ... and write the latency histograms to a CSV file */
+	    latency = 1;
+	    latency_csv = optarg;
+	    break;
+	case 'C': /* Read performance counters around the speed runs */
+	    counters = 1;
+	    break;
+	case 's': /* Walk the heap every so many requests of the util run */
+	    if ((sample_every = atoi(optarg)) <= 0)
+		app_error("ERROR: -s needs a positive number of requests");
+	    break;
+	case 'o': /* ... and write the samples to <base>.csv and <base>.map */
+	    sample_base = optarg;
+	    break;
+	case 'B': /* Time batches against the same requests one at a time */
+	    batch_bench = 1;
+	    break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -236,8 +425,28 @@ int main(int argc, char **argv)
 	printf("Using default tracefiles in %s\n", tracedir);
     }
 
+    if (sample_every) {
+	char path[MAXLINE];
+	int k;
+
+	sprintf(path, "%s.csv", sample_base);
+	if ((sample_csv = fopen(path, "w")) == NULL)
+	    unix_error("ERROR: could not open the heap walk CSV file");
+	sprintf(path, "%s.map", sample_base);
+	if ((sample_map = fopen(path, "w")) == NULL)
+	    unix_error("ERROR: could not open the heap map file");
+	fprintf(sample_csv, "trace,request,heap,live,mapped,mapped_live,"
+		"allocated,free,cached,"
+		"free_blocks,largest_free,ext_frag");
+	for (k = 0; k < FRAG_BUCKETS - 1; k++)
+	    fprintf(sample_csv, ",free_lt_%d", 64 << 2 * k);
+	fprintf(sample_csv, ",free_ge_%d\n", 64 << 2 * (FRAG_BUCKETS - 2));
+    }
+
     /* Initialize the timing package */
     init_fsecs();
+    if (latency)
+	init_ticks();
 
     /*
      * Optionally run and evaluate the libc malloc package 
@@ -254,7 +463,7 @@ int main(int argc, char **argv)
 	/* Evaluate the libc malloc package using the K-best scheme */
 	for (i=0; i < num_tracefiles; i++) {
 	    trace = read_trace(tracedir, tracefiles[i]);
-	    libc_stats[i].ops = trace->num_ops;
+	    libc_stats[i].ops = trace->num_ops - trace->num_markers;
 	    if (verbose > 1)
 		printf("Checking libc malloc for correctness, ");
 	    libc_stats[i].valid = eval_libc_valid(trace, i);
@@ -263,6 +472,11 @@ int main(int argc, char **argv)
 		if (verbose > 1)
 		    printf("and performance.\n");
 		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+		if (latency)
+		    libc_stats[i].lat = eval_latency(trace, 1);
+		if (counters)
+		    count_events(eval_libc_speed, &speed_params,
+				 libc_stats[i].events);
 	    }
 	    free_trace(trace);
 	}
@@ -272,6 +486,18 @@ int main(int argc, char **argv)
 	    printf("\nResults for libc malloc:\n");
 	    printresults(num_tracefiles, libc_stats);
 	}
+	if (latency) {
+	    printf("\nLatency for libc malloc, in %s:\n", LAT_UNIT);
+	    printlatency(num_tracefiles, libc_stats);
+	}
+	if (counters) {
+	    printf("\nCounters for libc malloc, per request:\n");
+	    printevents(num_tracefiles, libc_stats, 1);
+	    if (verbose) {
+		printf("\nCounters for libc malloc, per trace:\n");
+		printevents(num_tracefiles, libc_stats, 0);
+	    }
+	}
     }
 
     /*
@@ -291,7 +517,7 @@ int main(int argc, char **argv)
     /* Evaluate student's mm malloc package using the K-best scheme */
     for (i=0; i < num_tracefiles; i++) {
 	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
+	mm_stats[i].ops = trace->num_ops - trace->num_markers;
 	if (verbose > 1)
 	    printf("Checking mm_malloc for correctness, ");
 	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
@@ -299,11 +525,24 @@ int main(int argc, char **argv)
 	    if (verbose > 1)
 		printf("efficiency, ");
 	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
+	    mm_stats[i].peak = mem_heap_peak();
+	    mm_stats[i].heap = mem_heapsize();
+	    mm_stats[i].resident = mem_resident();
 	    speed_params.trace = trace;
 	    speed_params.ranges = ranges;
 	    if (verbose > 1)
 		printf("and performance.\n");
 	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    if (latency)
+		mm_stats[i].lat = eval_latency(trace, 0);
+	    if (counters)
+		count_events(eval_mm_speed, &speed_params, mm_stats[i].events);
+	    if (batch_bench && trace->num_batches > 0) {
+		batch_calls = 0;
+		mm_stats[i].batches = trace->num_batches;
+		mm_stats[i].loop_secs = fsecs(eval_mm_speed, &speed_params);
+		batch_calls = 1;
+	    }
 	}
 	free_trace(trace);
     }
@@ -312,8 +551,46 @@ int main(int argc, char **argv)
     if (verbose) {
 	printf("\nResults for mm malloc:\n");
 	printresults(num_tracefiles, mm_stats);
+	printf("\nMemory for mm malloc at the end of each trace:\n");
+	printmemory(num_tracefiles, mm_stats);
 	printf("\n");
     }
+    if (latency) {
+	printf("Latency for mm malloc, in %s:\n", LAT_UNIT);
+	printlatency(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (counters) {
+	printf("Counters for mm malloc, per request:\n");
+	printevents(num_tracefiles, mm_stats, 1);
+	printf("\n");
+	if (verbose) {
+	    printf("Counters for mm malloc, per trace:\n");
+	    printevents(num_tracefiles, mm_stats, 0);
+	    printf("\n");
+	}
+    }
+    if (batch_bench) {
+	printf("Batches for mm malloc, Kops/s:\n");
+	printbatches(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (sample_every) {
+	fclose(sample_csv);
+	fclose(sample_map);
+	printf("Heap walks written to %s.csv and %s.map\n\n", sample_base, sample_base);
+    }
+    if (latency_csv) {
+	FILE *fp;
+
+	if ((fp = fopen(latency_csv, "w")) == NULL)
+	    unix_error("ERROR: could not open the latency CSV file");
+	fprintf(fp, "package,trace,request,%s_lo,%s_hi,count\n", LAT_UNIT, LAT_UNIT);
+	if (run_libc)
+	    dumplatency(fp, "libc", num_tracefiles, libc_stats);
+	dumplatency(fp, "mm", num_tracefiles, mm_stats);
+	fclose(fp);
+    }
 
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
@@ -363,6 +640,9 @@ int main(int argc, char **argv)
 	printf("perfidx:%.0f\n", perfindex);
     }
 
+    if (mt_counts > 0 && errors == 0)
+	run_mt(tracefiles, num_tracefiles, run_libc);
+
     exit(0);
 }
 
@@ -383,8 +663,9 @@ static int add_range(range_t **ranges, char *lo, int size,
 		     int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    range_t *p, *prev[RANGE_LEVELS];
     char msg[MAXLINE];
+    int levels;
 
     assert(size > 0);
 
@@ -396,59 +677,98 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
-	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
+    /* The payload must lie within a heap or a chunk mapped by memlib */
+    if (!mem_contains(lo, size)) {
+	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p) and mapped chunks",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    /*
+     * The payload must not overlap any other payloads. The ranges do
+     * not overlap each other, so only the last one starting below lo
+     * and the first one starting at or above it can overlap this one.
+     */
+    if (*ranges == NULL)
+	*ranges = new_range(RANGE_LEVELS);
+    find_range(*ranges, lo, prev);
+    p = prev[0];
+    if (p == *ranges || p->hi < lo)
+	p = p->next[0];
+    if (p != NULL && p->lo <= hi) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
      * by creating a range struct and adding it the range list.
      */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-	unix_error("malloc error in add_range");
-    p->next = *ranges;
+    for (levels = 1; levels < RANGE_LEVELS && rand() % RANGE_FANOUT == 0;
+	 levels++)
+	;
+    p = new_range(levels);
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    for (levels--; levels >= 0; levels--) {
+	p->next[levels] = prev[levels]->next[levels];
+	prev[levels]->next[levels] = p;
+    }
     return 1;
 }
 
-/* 
- * remove_range - Free the range record of block whose payload starts at lo 
+/*
+ * new_range - allocate a range record on the given number of levels
  */
-static void remove_range(range_t **ranges, char *lo)
+static range_t *new_range(int levels)
 {
     range_t *p;
-    range_t **prevpp = ranges;
-    int size;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    p = calloc(1, sizeof(range_t) + levels * sizeof(range_t *));
+    if (p == NULL)
+	unix_error("malloc error in add_range");
+    p->levels = levels;
+    return p;
+}
+
+/*
+ * find_range - on each level, find the last range starting below lo,
+ *     or the head if there is none
+ */
+static void find_range(range_t *head, char *lo, range_t **prev)
+{
+    range_t *p = head;
+    int level;
+
+    for (level = RANGE_LEVELS - 1; level >= 0; level--) {
+	while (p->next[level] != NULL && p->next[level]->lo < lo)
+	    p = p->next[level];
+	prev[level] = p;
     }
 }
 
+/* 
+ * remove_range - Free the range record of block whose payload starts at lo 
+ */
+static void remove_range(range_t **ranges, char *lo)
+{
+    range_t *p, *prev[RANGE_LEVELS];
+    int level;
+
+    if (*ranges == NULL)
+	return;
+    find_range(*ranges, lo, prev);
+    p = prev[0]->next[0];
+    if (p == NULL || p->lo != lo)
+	return;
+    for (level = 0; level < p->levels; level++)
+	prev[level]->next[level] = p->next[level];
+    free(p);
+}
+
 /*
  * clear_ranges - free all of the range records for a trace 
  */
@@ -458,7 +778,7 @@ static void clear_ranges(range_t **ranges)
     range_t *pnext;
 
     for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
+        pnext = p->next[0];
         free(p);
     }
     *ranges = NULL;
@@ -481,9 +801,12 @@ static trace_t *read_trace(char *tracedir, char *filename)
     unsigned index, size;
     unsigned max_index = 0;
     unsigned op_index;
+    uint32_t magic;
+    struct timeval start, end;
 
     if (verbose > 1)
 	printf("Reading tracefile: %s\n", filename);
+    gettimeofday(&start, NULL);
 
     /* Allocate the trace record */
     if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
@@ -496,6 +819,16 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	sprintf(msg, "Could not open %s in read_trace", path);
 	unix_error(msg);
     }
+
+    /* A binary trace is decoded rather than parsed */
+    if (fread(&magic, sizeof(magic), 1, tracefile) == 1 &&
+	magic == TRACEBIN_MAGIC) {
+	map_trace(trace, tracefile, path);
+	fclose(tracefile);
+	goto done;
+    }
+    rewind(tracefile);
+
     fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
     fscanf(tracefile, "%d", &(trace->num_ids));     
     fscanf(tracefile, "%d", &(trace->num_ops));     
@@ -540,6 +873,31 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	    trace->ops[op_index].type = FREE;
 	    trace->ops[op_index].index = index;
 	    break;
+	case 'b':
+	    fscanf(tracefile, "%u", &index);
+	    trace->ops[op_index].type = BATCH;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = 0;
+	    break;
+	case 'c':
+	    fscanf(tracefile, "%u %u", &index, &size);
+	    trace->ops[op_index].type = CALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 's':
+	    fscanf(tracefile, "%u %u", &index, &size);
+	    trace->ops[op_index].type = FREE_SIZED;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    break;
+	case 'm':
+	    fscanf(tracefile, "%u", &index);
+	    trace->ops[op_index].type = MEMALIGN;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = 0;
+	    break;
 	default:
 	    printf("Bogus type character (%c) in tracefile %s\n", 
 		   type[0], path);
@@ -551,10 +909,143 @@ static trace_t *read_trace(char *tracedir, char *filename)
     fclose(tracefile);
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
-    
+
+ done:
+    check_trace(trace, path);
+    if (verbose > 1) {
+	gettimeofday(&end, NULL);
+	printf("Read %d requests in %.6f secs\n", trace->num_ops,
+	       (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6);
+    }
     return trace;
 }
 
+/*
+ * map_trace - map a binary trace (see tracebin.h) and decode its
+ *     requests into trace->ops, after checking the header and every id
+ */
+static void map_trace(trace_t *trace, FILE *tracefile, char *path)
+{
+    tracebin_hdr_t *hdr;
+    const unsigned char *p, *end;
+    void *map;
+    struct stat st;
+    int i;
+
+    if (fstat(fileno(tracefile), &st) < 0 || st.st_size < sizeof(*hdr)) {
+	sprintf(msg, "Could not read the header of %s in map_trace", path);
+	unix_error(msg);
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(tracefile), 0);
+    if (map == MAP_FAILED) {
+	sprintf(msg, "Could not map %s in map_trace", path);
+	unix_error(msg);
+    }
+
+    hdr = map;
+    if (hdr->version != TRACEBIN_VERSION || hdr->num_ops < 0 ||
+	hdr->num_ids < 1) {
+	printf("Bogus header in binary tracefile %s\n", path);
+	exit(1);
+    }
+    trace->sugg_heapsize = hdr->sugg_heapsize;
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->weight = hdr->weight;
+    if ((trace->ops = 
+	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+	unix_error("malloc 2 failed in map_trace");
+
+    p = (const unsigned char *)(hdr + 1);
+    end = (const unsigned char *)map + st.st_size;
+    for (i = 0; i < trace->num_ops; i++)
+	if ((p = tracebin_read(p, end, (tracebin_op_t *)&trace->ops[i])) == NULL ||
+	    trace->ops[i].type < 0 || trace->ops[i].type >= NUM_TYPES ||
+	    (trace->ops[i].type != BATCH && trace->ops[i].type != MEMALIGN &&
+	     trace->ops[i].index >= trace->num_ids)) {
+	    printf("Bogus request %d in binary tracefile %s\n", i, path);
+	    exit(1);
+	}
+    if (p != end) {
+	printf("Bytes after the last request in binary tracefile %s\n", path);
+	exit(1);
+    }
+    munmap(map, st.st_size);
+
+    if ((trace->blocks = (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("malloc 3 failed in map_trace");
+    if ((trace->block_sizes =
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 4 failed in map_trace");
+}
+
+/*
+ * check_trace - check that each BATCH request is followed by the
+ *     requests it covers, allocations of one size or frees, that each
+ *     MEMALIGN request gives a power of two and is followed by an
+ *     allocation, and that each sized free gives the size its block
+ *     was last allocated or reallocated with; count the BATCH and
+ *     MEMALIGN requests and make room for the pointers of the largest
+ *     batch. Uses trace->block_sizes to remember the sizes
+ */
+static void check_trace(trace_t *trace, char *path)
+{
+    traceop_t *op;
+    int i, k, n, max_batch = 0;
+
+    trace->num_batches = trace->num_markers = 0;
+    for (i = 0; i < trace->num_ops; i++) {
+	op = &trace->ops[i];
+	switch (op->type) {
+	case ALLOC:
+	case REALLOC:
+	case CALLOC:
+	    trace->block_sizes[op->index] = op->size;
+	    continue;
+	case FREE_SIZED:
+	    if (op->size != trace->block_sizes[op->index]) {
+		printf("Bogus sized free at request %d in tracefile %s\n", i, path);
+		exit(1);
+	    }
+	    continue;
+	case MEMALIGN:
+	    n = op->index;
+	    if (n < 1 || (n & (n - 1)) != 0 || i + 1 >= trace->num_ops ||
+		op[1].type != ALLOC) {
+		printf("Bogus memalign at request %d in tracefile %s\n", i, path);
+		exit(1);
+	    }
+	    trace->num_markers++;
+	    continue;
+	case BATCH:
+	    break;
+	default:
+	    continue;
+	}
+	n = trace->ops[i].index;
+	op = &trace->ops[i + 1];
+	if (n < 1 || n > trace->num_ops - i - 1 ||
+	    (op->type != ALLOC && op->type != FREE)) {
+	    printf("Bogus batch at request %d in tracefile %s\n", i, path);
+	    exit(1);
+	}
+	for (k = 0; k < n; k++) {
+	    if (op[k].type != op->type || (op->type == ALLOC && op[k].size != op->size)) {
+		printf("Bogus batch at request %d in tracefile %s\n", i, path);
+		exit(1);
+	    }
+	    if (op->type == ALLOC)
+		trace->block_sizes[op[k].index] = op[k].size;
+	}
+	trace->num_batches++;
+	trace->num_markers++;
+	max_batch = n > max_batch ? n : max_batch;
+	i += n;
+    }
+    if ((trace->batch = malloc(max_batch * sizeof(void *) + 1)) == NULL)
+	unix_error("malloc failed in check_trace");
+}
+
 /*
  * free_trace - Free the trace record and the three arrays it points
  *              to, all of which were allocated in read_trace().
@@ -564,6 +1055,7 @@ void free_trace(trace_t *trace)
     free(trace->ops);         /* free the three arrays... */
     free(trace->blocks);      
     free(trace->block_sizes);
+    free(trace->batch);
     free(trace);              /* and the trace record itself... */
 }
 
@@ -577,7 +1069,7 @@ void free_trace(trace_t *trace)
  */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) 
 {
-    int i, j;
+    int i, j, n;
     int index;
     int size;
     int oldsize;
@@ -654,7 +1146,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -675,6 +1167,82 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    mm_free(p);
 	    break;
 
+	case BATCH: /* mm_malloc_batch or mm_free_batch */
+	    if (!batch_calls)
+		break;
+	    n = index;
+	    if (trace->ops[i + 1].type == FREE) {
+		for (j = 0; j < n; j++) {
+		    p = trace->batch[j] = trace->blocks[trace->ops[i + 1 + j].index];
+		    remove_range(ranges, p);
+		}
+		mm_free_batch(trace->batch, n);
+		i += n;
+		break;
+	    }
+
+	    size = trace->ops[i + 1].size;
+	    if (mm_malloc_batch(size, n, trace->batch) != n) {
+		malloc_error(tracenum, i, "mm_malloc_batch failed.");
+		return 0;
+	    }
+	    /* Check, fill and remember each block as for mm_malloc */
+	    for (j = 0; j < n; j++) {
+		i++;
+		index = trace->ops[i].index;
+		p = trace->batch[j];
+		if (add_range(ranges, p, size, tracenum, i) == 0)
+		    return 0;
+		memset(p, index & 0xFF, size);
+		trace->blocks[index] = p;
+		trace->block_sizes[index] = size;
+	    }
+	    break;
+
+	case CALLOC: /* mm_calloc */
+	    if ((p = mm_calloc(1, size)) == NULL) {
+		malloc_error(tracenum, i, "mm_calloc failed.");
+		return 0;
+	    }
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		return 0;
+	    for (j = 0; j < size; j++) {
+		if (p[j] != 0) {
+		    malloc_error(tracenum, i, "mm_calloc did not zero the block");
+		    return 0;
+		}
+	    }
+	    memset(p, index & 0xFF, size);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+	case FREE_SIZED: /* mm_free_sized */
+	    p = trace->blocks[index];
+	    remove_range(ranges, p);
+	    mm_free_sized(p, size);
+	    break;
+
+	case MEMALIGN: /* mm_memalign, for the allocation after it */
+	    n = index;
+	    i++;
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if ((p = mm_memalign(n, size)) == NULL) {
+		malloc_error(tracenum, i, "mm_memalign failed.");
+		return 0;
+	    }
+	    if ((uintptr_t)p % n != 0) {
+		malloc_error(tracenum, i, "mm_memalign did not align the block");
+		return 0;
+	    }
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		return 0;
+	    memset(p, index & 0xFF, size);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
@@ -690,15 +1258,16 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
- *   
+ *   largest size the heap reached while running the student's malloc 
+ *   package on the trace. The package may shrink the heap again, so
+ *   this is memlib's peak of the brk pointer, not its final value.
+ *   Pages left over from earlier runs are discarded first, so that
+ *   mem_resident() afterwards counts only what this run kept.
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 {   
-    int i;
+    int i, j, n;
+    int next_sample = sample_every;
     int index;
     int size, newsize, oldsize;
     int max_total_size = 0;
@@ -707,9 +1276,13 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
     char *newp, *oldp;
 
     /* initialize the heap and the mm malloc package */
+    for (i = 0; i < mem_regions(); i++)
+	mem_discard(mem_region_lo(i), mem_region_size(i));
     mem_reset_brk();
     if (mm_init() < 0)
 	app_error("mm_init failed in eval_mm_util");
+    /* sample_heap takes the non-NULL blocks as live */
+    memset(trace->blocks, 0, trace->num_ids * sizeof(char *));
 
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
@@ -762,6 +1335,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    p = trace->blocks[index];
 	    
 	    mm_free(p);
+	    trace->blocks[index] = NULL;
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -769,13 +1343,72 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    break;
 
+	case BATCH: /* mm_malloc_batch or mm_free_batch */
+	    if (!batch_calls)
+		break;
+	    n = trace->ops[i].index;
+	    if (trace->ops[i + 1].type == FREE) {
+		for (j = 0; j < n; j++) {
+		    index = trace->ops[++i].index;
+		    trace->batch[j] = trace->blocks[index];
+		    trace->blocks[index] = NULL;
+		    total_size -= trace->block_sizes[index];
+		}
+		mm_free_batch(trace->batch, n);
+		break;
+	    }
+	    size = trace->ops[i + 1].size;
+	    if (mm_malloc_batch(size, n, trace->batch) != n)
+		app_error("mm_malloc_batch failed in eval_mm_util");
+	    for (j = 0; j < n; j++) {
+		index = trace->ops[++i].index;
+		trace->blocks[index] = trace->batch[j];
+		trace->block_sizes[index] = size;
+	    }
+	    total_size += n * size;
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+	    break;
+
+	case CALLOC: /* mm_calloc */
+	case MEMALIGN: /* mm_memalign, for the allocation after it */
+	    if (trace->ops[i].type == CALLOC) {
+		index = trace->ops[i].index;
+		size = trace->ops[i].size;
+		p = mm_calloc(1, size);
+	    } else {
+		index = trace->ops[i + 1].index;
+		size = trace->ops[i + 1].size;
+		p = mm_memalign(trace->ops[i++].index, size);
+	    }
+	    if (p == NULL)
+		app_error("mm_calloc or mm_memalign failed in eval_mm_util");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    total_size += size;
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+	    break;
+
+	case FREE_SIZED: /* mm_free_sized */
+	    index = trace->ops[i].index;
+	    mm_free_sized(trace->blocks[index], trace->ops[i].size);
+	    trace->blocks[index] = NULL;
+	    total_size -= trace->block_sizes[index];
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_util");
 
         }
+	/* a batch may step over the request a sample was due after */
+	if (sample_every && i + 1 >= next_sample) {
+	    sample_heap(trace, tracenum, i + 1, total_size);
+	    next_sample = (i + 1) / sample_every * sample_every + sample_every;
+	}
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mem_heap_peak());
 }
 
 
@@ -785,7 +1418,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size, newsize;
+    int i, j, n, index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
@@ -821,11 +1454,602 @@ static void eval_mm_speed(void *ptr)
             mm_free(block);
             break;
 
+	case BATCH: /* mm_malloc_batch or mm_free_batch */
+	    if (!batch_calls)
+		break;
+	    n = trace->ops[i].index;
+	    if (trace->ops[i + 1].type == FREE) {
+		for (j = 0; j < n; j++)
+		    trace->batch[j] = trace->blocks[trace->ops[++i].index];
+		mm_free_batch(trace->batch, n);
+		break;
+	    }
+	    if (mm_malloc_batch(trace->ops[i + 1].size, n, trace->batch) != n)
+		app_error("mm_malloc_batch error in eval_mm_speed");
+	    for (j = 0; j < n; j++)
+		trace->blocks[trace->ops[++i].index] = trace->batch[j];
+	    break;
+
+	case CALLOC: /* mm_calloc */
+	    if ((p = mm_calloc(1, trace->ops[i].size)) == NULL)
+		app_error("mm_calloc error in eval_mm_speed");
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+	case FREE_SIZED: /* mm_free_sized */
+	    mm_free_sized(trace->blocks[trace->ops[i].index], trace->ops[i].size);
+	    break;
+
+	case MEMALIGN: /* mm_memalign, for the allocation after it */
+	    n = trace->ops[i++].index;
+	    if ((p = mm_memalign(n, trace->ops[i].size)) == NULL)
+		app_error("mm_memalign error in eval_mm_speed");
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
 }
 
+/*
+ * read_ticks - a fine-grained timestamp: the time stamp counter on x86,
+ *     nanoseconds elsewhere
+ */
+#if defined(__i386__) || defined(__x86_64__)
+static unsigned long long read_ticks(void)
+{
+    return __rdtsc();
+}
+#else
+static unsigned long long read_ticks(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+/*
+ * init_ticks - measure the cost of a back-to-back read_ticks() pair,
+ *     which eval_latency subtracts from every sample
+ */
+static void init_ticks(void)
+{
+    unsigned long long t0, t1;
+    int i;
+
+    tick_overhead = ~0ULL;
+    for (i = 0; i < 1000; i++) {
+	t0 = read_ticks();
+	t1 = read_ticks();
+	if (t1 - t0 < tick_overhead)
+	    tick_overhead = t1 - t0;
+    }
+}
+
+/*
+ * hist_add - count one sample. Values below LAT_SUB get a bucket each;
+ *     above, each power of two is split into LAT_SUB buckets, so a
+ *     bucket is at most 1/LAT_SUB of its values wide.
+ */
+static void hist_add(hist_t *hist, unsigned long long ticks)
+{
+    int e, b;
+
+    if (ticks < LAT_SUB)
+	b = ticks;
+    else {
+	e = 63 - __builtin_clzll(ticks);
+	b = (e - 3) * LAT_SUB + ((ticks >> (e - 4)) & (LAT_SUB - 1));
+    }
+    hist->count[b]++;
+    hist->n++;
+    if (ticks > hist->max)
+	hist->max = ticks;
+}
+
+/* bucket_lo - the smallest value counted in bucket b */
+static unsigned long long bucket_lo(int b)
+{
+    if (b < LAT_SUB)
+	return b;
+    return (unsigned long long)(LAT_SUB + b % LAT_SUB) << (b / LAT_SUB - 1);
+}
+
+/*
+ * hist_quantile - upper end of the bucket holding the q-quantile, or
+ *     the largest sample if that is smaller
+ */
+static unsigned long long hist_quantile(hist_t *hist, double q)
+{
+    unsigned long need = (unsigned long)(q * hist->n + 0.5), seen = 0;
+    int b;
+
+    if (need == 0)
+	need = 1;
+    for (b = 0; b < LAT_BUCKETS - 1; b++)
+	if ((seen += hist->count[b]) >= need)
+	    break;
+    return bucket_lo(b + 1) - 1 < hist->max ? bucket_lo(b + 1) - 1 : hist->max;
+}
+
+/*
+ * eval_latency - replay a trace LAT_REPS times against mm, or libc if
+ *     libc is set, timing each request on its own, and return one
+ *     histogram per request type
+ */
+static hist_t *eval_latency(trace_t *trace, int libc)
+{
+    hist_t *lat;
+    traceop_t *op;
+    unsigned long long t0, t1;
+    int rep, i;
+    char *p;
+
+    if ((lat = calloc(NUM_TYPES, sizeof(hist_t))) == NULL)
+	unix_error("calloc failed in eval_latency");
+
+    for (rep = 0; rep < LAT_REPS; rep++) {
+	if (!libc) {
+	    mem_reset_brk();
+	    if (mm_init() < 0)
+		app_error("mm_init failed in eval_latency");
+	}
+	for (i = 0; i < trace->num_ops; i++) {
+	    op = &trace->ops[i];
+	    switch (op->type) {
+
+	    case ALLOC:
+		t0 = read_ticks();
+		p = libc ? malloc(op->size) : mm_malloc(op->size);
+		t1 = read_ticks();
+		if (p == NULL)
+		    app_error("malloc failed in eval_latency");
+		trace->blocks[op->index] = p;
+		break;
+
+	    case REALLOC:
+		p = trace->blocks[op->index];
+		t0 = read_ticks();
+		p = libc ? realloc(p, op->size) : mm_realloc(p, op->size);
+		t1 = read_ticks();
+		if (p == NULL)
+		    app_error("realloc failed in eval_latency");
+		trace->blocks[op->index] = p;
+		break;
+
+	    case FREE:
+		p = trace->blocks[op->index];
+		t0 = read_ticks();
+		if (libc)
+		    free(p);
+		else
+		    mm_free(p);
+		t1 = read_ticks();
+		break;
+
+	    case BATCH: /* timed one request at a time */
+		continue;
+
+	    case CALLOC:
+		t0 = read_ticks();
+		p = libc ? calloc(1, op->size) : mm_calloc(1, op->size);
+		t1 = read_ticks();
+		if (p == NULL)
+		    app_error("calloc failed in eval_latency");
+		trace->blocks[op->index] = p;
+		break;
+
+	    case FREE_SIZED:
+		p = trace->blocks[op->index];
+		t0 = read_ticks();
+		if (libc)
+		    free(p);
+		else
+		    mm_free_sized(p, op->size);
+		t1 = read_ticks();
+		break;
+
+	    case MEMALIGN: /* with the allocation after it */
+		i++;
+		t0 = read_ticks();
+		p = libc ? libc_memalign(op->index, op[1].size) :
+		    mm_memalign(op->index, op[1].size);
+		t1 = read_ticks();
+		if (p == NULL)
+		    app_error("memalign failed in eval_latency");
+		trace->blocks[op[1].index] = p;
+		break;
+
+	    default:
+		app_error("Nonexistent request type in eval_latency");
+	    }
+	    t1 -= t0;
+	    hist_add(&lat[op->type], t1 > tick_overhead ? t1 - tick_overhead : 0);
+	}
+    }
+    return lat;
+}
+
+/*
+ * sample_heap - walk the mm heap after request opnum, while live bytes
+ *     are allocated, and add a row to the CSV file: the bytes in the
+ *     arenas and the live bytes in them, the bytes mapped with mem_map
+ *     and the live bytes in those, which the walk does not see, bytes in
+ *     allocated, free and cached blocks, the number of free blocks and
+ *     the largest, external fragmentation (1 - largest / free), and free
+ *     blocks counted by size. The map file gets a line per arena, each
+ *     character a 1/MAP_WIDTH slice of it: '#' mostly allocated, '.'
+ *     mostly free, '+' mostly cached, ' ' outside of any block.
+ */
+static void sample_heap(trace_t *trace, int tracenum, int opnum, int live)
+{
+    size_t bytes[3] = {0, 0, 0}, largest = 0, nfree = 0, size;
+    size_t heap = mem_heapsize() - mem_mapsize();
+    long mapped_live = 0;
+    size_t (*cells)[MAP_WIDTH][3];
+    unsigned long hist[FRAG_BUCKETS] = {0};
+    mm_block_t block;
+    void *cursor;
+    char *lo, *p, line[MAP_WIDTH + 1];
+    int r, k, c, best;
+    size_t scale, cell_end;
+
+    if ((cells = calloc(mem_regions(), sizeof(*cells))) == NULL)
+	unix_error("calloc failed in sample_heap");
+    for (k = 0; k < trace->num_ids; k++)
+	if (trace->blocks[k] != NULL && mem_region_of(trace->blocks[k]) < 0)
+	    mapped_live += trace->block_sizes[k];
+
+    for (cursor = mm_heap_walk(NULL, &block); cursor != NULL;
+	 cursor = mm_heap_walk(cursor, &block)) {
+	bytes[block.state] += block.size;
+	if (block.state == MM_BLOCK_FREE) {
+	    nfree++;
+	    largest = block.size > largest ? block.size : largest;
+	    for (k = 0, size = 64; k < FRAG_BUCKETS - 1 && block.size >= size; k++)
+		size <<= 2;
+	    hist[k]++;
+	}
+
+	/* spread the block over the map cells it covers */
+	if ((r = mem_region_of(block.addr)) < 0)
+	    continue;
+	lo = mem_region_lo(r);
+	scale = (mem_region_size(r) + MAP_WIDTH - 1) / MAP_WIDTH;
+	for (p = block.addr; p < (char *)block.addr + block.size; p += size) {
+	    c = (p - lo) / scale;
+	    cell_end = (c + 1) * scale;
+	    size = lo + cell_end - p;
+	    if (p + size > (char *)block.addr + block.size)
+		size = (char *)block.addr + block.size - p;
+	    cells[r][c][block.state] += size;
+	}
+    }
+
+    fprintf(sample_csv, "%d,%d,%zu,%ld,%zu,%ld,%zu,%zu,%zu,%zu,%zu,%.4f",
+	    tracenum, opnum, heap, live - mapped_live, mem_mapsize(), mapped_live,
+	    bytes[MM_BLOCK_ALLOC], bytes[MM_BLOCK_FREE],
+	    bytes[MM_BLOCK_CACHED], nfree, largest,
+	    bytes[MM_BLOCK_FREE] ? 1 - (double)largest / bytes[MM_BLOCK_FREE] : 0);
+    for (k = 0; k < FRAG_BUCKETS; k++)
+	fprintf(sample_csv, ",%lu", hist[k]);
+    fprintf(sample_csv, "\n");
+
+    fprintf(sample_map, "trace %d, request %d: heap %zu kB, %ld kB live, %zu kB mapped\n",
+	    tracenum, opnum, heap / 1024, (live - mapped_live) / 1024,
+	    mem_mapsize() / 1024);
+    for (r = 0; r < mem_regions(); r++) {
+	if (mem_region_size(r) == 0)
+	    continue;
+	for (c = 0; c < MAP_WIDTH; c++) {
+	    best = -1;
+	    for (k = 0; k < 3; k++)
+		if (cells[r][c][k] > 0 && (best < 0 || cells[r][c][k] > cells[r][c][best]))
+		    best = k;
+	    line[c] = best < 0 ? ' ' : "#.+"[best];
+	}
+	line[MAP_WIDTH] = '\0';
+	fprintf(sample_map, "%2d %7zu kB |%s|\n", r, mem_region_size(r) / 1024, line);
+    }
+    free(cells);
+}
+
+/*
+ * count_events - run f(argp) once more with a performance counter open
+ *     for each event, and store their deltas in events. An event the
+ *     kernel or the CPU cannot count is stored as -1; when none can be
+ *     counted, say why once. Counters that were multiplexed are scaled
+ *     up to the whole run.
+ */
+static void count_events(fsecs_test_funct f, void *argp, long long *events)
+{
+#ifdef __linux__
+    static struct { __u32 type; __u64 config; } attrs[NUM_EVENTS] = {
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+	{PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+	 (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+	 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+	{PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL |
+	 (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+	 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+	{PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+	 (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+	 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+    };
+    static int warned = 0;
+    struct perf_event_attr attr;
+    unsigned long long val[3];   /* value, time enabled, time running */
+    int fd[NUM_EVENTS], e, opened = 0, err = 0;
+
+    for (e = 0; e < NUM_EVENTS; e++) {
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = attrs[e].type;
+	attr.config = attrs[e].config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+	    PERF_FORMAT_TOTAL_TIME_RUNNING;
+	fd[e] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	if (fd[e] >= 0)
+	    opened++;
+	else if (err == 0)
+	    err = errno;
+    }
+    if (opened < NUM_EVENTS && !warned) {
+	printf("mdriver: %d of %d performance counters unavailable (%s)\n",
+	       NUM_EVENTS - opened, NUM_EVENTS, strerror(err));
+	warned = 1;
+    }
+
+    for (e = 0; e < NUM_EVENTS; e++)
+	if (fd[e] >= 0)
+	    ioctl(fd[e], PERF_EVENT_IOC_ENABLE, 0);
+    f(argp);
+    for (e = 0; e < NUM_EVENTS; e++)
+	if (fd[e] >= 0)
+	    ioctl(fd[e], PERF_EVENT_IOC_DISABLE, 0);
+
+    for (e = 0; e < NUM_EVENTS; e++) {
+	events[e] = -1;
+	if (fd[e] < 0)
+	    continue;
+	if (read(fd[e], val, sizeof(val)) == sizeof(val) && val[2] > 0)
+	    events[e] = val[2] < val[1] ?
+		(long long)((double)val[0] * val[1] / val[2]) : (long long)val[0];
+	close(fd[e]);
+    }
+#else
+    int e;
+
+    for (e = 0; e < NUM_EVENTS; e++)
+	events[e] = -1;
+    f(argp);
+#endif
+}
+
+/*
+ * split_trace - deal the requests of a trace out to nthreads streams by
+ *     block id. With -P, a free goes to the thread after the one that
+ *     allocated the block. mt_need records how many requests on the
+ *     same id come before each one, so that a free waits for the alloc
+ *     and an alloc reusing the id waits for the free of the old block.
+ */
+static void split_trace(trace_t *trace, int nthreads, stream_t *streams)
+{
+    int i, index, t, type;
+    int *count;
+
+    if ((count = calloc(trace->num_ids, sizeof(int))) == NULL)
+	unix_error("calloc failed in split_trace");
+    for (t = 0; t < nthreads; t++) {
+	streams[t].trace = trace;
+	streams[t].num_ops = 0;
+	if ((streams[t].ops = malloc(trace->num_ops * sizeof(int))) == NULL)
+	    unix_error("malloc failed in split_trace");
+    }
+
+    for (i = 0; i < trace->num_ops; i++) {
+	type = trace->ops[i].type;
+	if (type == BATCH)
+	    continue;          /* replayed one request at a time */
+	/* a MEMALIGN request goes with the allocation after it */
+	index = trace->ops[type == MEMALIGN ? i + 1 : i].index;
+	t = index % nthreads;
+	if ((type == FREE || type == FREE_SIZED) && mt_handoff)
+	    t = (t + 1) % nthreads;
+	mt_need[i] = count[index]++;
+	streams[t].ops[streams[t].num_ops++] = i;
+	if (type == MEMALIGN)
+	    i++;
+    }
+    free(count);
+}
+
+/*
+ * mt_worker - replay one stream. Each request waits, yielding the CPU,
+ *     until the requests on its id before it have happened; they come
+ *     earlier in the trace, so the waits cannot deadlock.
+ */
+static void *mt_worker(void *vargp)
+{
+    stream_t *stream = (stream_t *)vargp;
+    trace_t *trace = stream->trace;
+    traceop_t *op;
+    int i, index;
+    char *p;
+
+    pthread_barrier_wait(&mt_barrier);
+    gettimeofday(&stream->start, NULL);
+    for (i = 0; i < stream->num_ops; i++) {
+	op = &trace->ops[stream->ops[i]];
+	index = op->type == MEMALIGN ? op[1].index : op->index;
+	while (__atomic_load_n(&mt_done[index], __ATOMIC_ACQUIRE) < mt_need[stream->ops[i]])
+	    sched_yield();
+        switch (op->type) {
+
+        case ALLOC:
+	    p = mt_libc ? malloc(op->size) : mm_malloc(op->size);
+	    if (p == NULL)
+		app_error("malloc failed in mt_worker");
+	    trace->blocks[index] = p;
+	    break;
+
+	case REALLOC:
+	    p = trace->blocks[index];
+	    p = mt_libc ? realloc(p, op->size) : mm_realloc(p, op->size);
+	    if (p == NULL)
+		app_error("realloc failed in mt_worker");
+	    trace->blocks[index] = p;
+	    break;
+
+        case FREE:
+	    if (mt_libc)
+		free(trace->blocks[index]);
+	    else
+		mm_free(trace->blocks[index]);
+	    break;
+
+	case CALLOC:
+	    p = mt_libc ? calloc(1, op->size) : mm_calloc(1, op->size);
+	    if (p == NULL)
+		app_error("calloc failed in mt_worker");
+	    trace->blocks[index] = p;
+	    break;
+
+	case FREE_SIZED:
+	    if (mt_libc)
+		free(trace->blocks[index]);
+	    else
+		mm_free_sized(trace->blocks[index], op->size);
+	    break;
+
+	case MEMALIGN: /* with the allocation after it */
+	    p = mt_libc ? libc_memalign(op->index, op[1].size) :
+		mm_memalign(op->index, op[1].size);
+	    if (p == NULL)
+		app_error("memalign failed in mt_worker");
+	    trace->blocks[index] = p;
+	    break;
+
+	case BATCH: /* split_trace leaves these out */
+	    break;
+	}
+	__atomic_store_n(&mt_done[index], mt_done[index] + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/*
+ * eval_mt - replay a trace on nthreads threads against mm, or libc if
+ *     libc is set, MT_REPS times, and return the best wall-clock time
+ *     from the first thread starting to the last one finishing
+ */
+static double eval_mt(trace_t *trace, int nthreads, int libc)
+{
+    stream_t streams[MAX_THREADS];
+    pthread_t tids[MAX_THREADS];
+    struct timeval start, end;
+    double secs, best = DBL_MAX;
+    int rep, t;
+
+    mt_libc = libc;
+    if ((mt_need = malloc(trace->num_ops * sizeof(int))) == NULL ||
+	(mt_done = malloc(trace->num_ids * sizeof(int))) == NULL)
+	unix_error("malloc failed in eval_mt");
+    split_trace(trace, nthreads, streams);
+
+    for (rep = 0; rep < MT_REPS; rep++) {
+	memset(mt_done, 0, trace->num_ids * sizeof(int));
+	if (!libc) {
+	    mem_reset_brk();
+	    if (mm_init() < 0)
+		app_error("mm_init failed in eval_mt");
+	}
+	pthread_barrier_init(&mt_barrier, NULL, nthreads + 1);
+	for (t = 0; t < nthreads; t++)
+	    if (pthread_create(&tids[t], NULL, mt_worker, &streams[t]) != 0)
+		unix_error("pthread_create failed in eval_mt");
+	pthread_barrier_wait(&mt_barrier);
+	for (t = 0; t < nthreads; t++)
+	    pthread_join(tids[t], NULL);
+	gettimeofday(&end, NULL);
+	pthread_barrier_destroy(&mt_barrier);
+
+	start = streams[0].start;
+	for (t = 1; t < nthreads; t++)
+	    if (timercmp(&streams[t].start, &start, <))
+		start = streams[t].start;
+
+	secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+	if (secs < best)
+	    best = secs;
+    }
+
+    for (t = 0; t < nthreads; t++)
+	free(streams[t].ops);
+    free(mt_need);
+    free(mt_done);
+    return best;
+}
+
+/*
+ * run_mt - replay every trace on each thread count given with -T and
+ *     print the throughput, per trace with -v and summed over the traces,
+ *     with the time the threads of the last mm replay spent waiting for
+ *     arena locks
+ */
+static void run_mt(char **tracefiles, int num_tracefiles, int run_libc)
+{
+    trace_t *trace;
+    double secs, libc_secs, wait, total_secs, total_libc, total_wait;
+    double ops, total_ops;
+    unsigned long waits, total_waits;
+    int i, n;
+
+    printf("\nMultithreaded replay, blocks split over threads by id%s:\n",
+	   mt_handoff ? ", each freed by the next thread" : "");
+    printf("%5s%8s%10s%10s%10s%10s\n",
+	   "trace", "threads", "mm Kops", "waits", "wait ms", "libc Kops");
+    for (n = 0; n < mt_counts; n++) {
+	total_secs = total_libc = total_wait = total_ops = 0;
+	total_waits = 0;
+	for (i = 0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    ops = trace->num_ops - trace->num_markers;
+	    secs = eval_mt(trace, mt_threads[n], 0);
+	    mm_lock_stats(&waits, &wait);
+	    libc_secs = run_libc ? eval_mt(trace, mt_threads[n], 1) : 0;
+	    free_trace(trace);
+
+	    if (verbose) {
+		printf("%2d%11d%10.0f%10lu%10.3f", i, mt_threads[n],
+		       ops / 1e3 / secs, waits, wait * 1e3);
+		if (run_libc)
+		    printf("%10.0f", ops / 1e3 / libc_secs);
+		printf("\n");
+	    }
+	    total_ops += ops;
+	    total_secs += secs;
+	    total_libc += libc_secs;
+	    total_waits += waits;
+	    total_wait += wait;
+	}
+	printf("%5s%8d%10.0f%10lu%10.3f", "Total", mt_threads[n],
+	       total_ops / 1e3 / total_secs, total_waits, total_wait * 1e3);
+	if (run_libc)
+	    printf("%10.0f", total_ops / 1e3 / total_libc);
+	printf("\n");
+    }
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -862,6 +2086,29 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 	    free(trace->blocks[trace->ops[i].index]);
 	    break;
 
+	case BATCH: /* libc has no batches: one request at a time */
+	    break;
+
+	case CALLOC: /* calloc */
+	    if ((p = calloc(1, trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "libc calloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+	case FREE_SIZED: /* free */
+	    free(trace->blocks[trace->ops[i].index]);
+	    break;
+
+	case MEMALIGN: /* posix_memalign, for the allocation after it */
+	    if ((p = libc_memalign(trace->ops[i].index, trace->ops[i + 1].size)) == NULL) {
+		malloc_error(tracenum, i, "libc posix_memalign failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[++i].index] = p;
+	    break;
+
 	default:
 	    app_error("invalid operation type  in eval_libc_valid");
 	}
@@ -907,15 +2154,69 @@ static void eval_libc_speed(void *ptr)
 	    block = trace->blocks[index];
 	    free(block);
 	    break;
+
+	case BATCH: /* libc has no batches: one request at a time */
+	    break;
+
+	case CALLOC: /* calloc */
+	    if ((p = calloc(1, trace->ops[i].size)) == NULL)
+		unix_error("calloc failed in eval_libc_speed");
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+	case FREE_SIZED: /* free */
+	    free(trace->blocks[trace->ops[i].index]);
+	    break;
+
+	case MEMALIGN: /* posix_memalign, for the allocation after it */
+	    if ((p = libc_memalign(trace->ops[i].index, trace->ops[i + 1].size)) == NULL)
+		unix_error("posix_memalign failed in eval_libc_speed");
+	    trace->blocks[trace->ops[++i].index] = p;
+	    break;
 	}
     }
 }
 
+/*
+ * libc_memalign - posix_memalign as a function that returns the block,
+ *     for alignments below the size of a pointer as well
+ */
+static void *libc_memalign(size_t alignment, size_t size)
+{
+    void *p;
+
+    if (alignment < sizeof(void *))
+	alignment = sizeof(void *);
+    return posix_memalign(&p, alignment, size) == 0 ? p : NULL;
+}
+
 /*************************************
  * Some miscellaneous helper routines
  ************************************/
 
 
+/*
+ * printbatches - for each trace with batches, mm throughput with the
+ *     batch functions and with the same requests made one at a time
+ */
+static void printbatches(int n, stats_t *stats)
+{
+    int i, found = 0;
+
+    printf("%5s%9s%10s%10s%9s\n", "trace", "batches", "batched", "per-call", "speedup");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid || stats[i].batches == 0)
+	    continue;
+	printf("%2d%12d%10.0f%10.0f%8.2fx\n", i, stats[i].batches,
+	       stats[i].ops / 1e3 / stats[i].secs,
+	       stats[i].ops / 1e3 / stats[i].loop_secs,
+	       stats[i].loop_secs / stats[i].secs);
+	found = 1;
+    }
+    if (!found)
+	printf("No batches in these traces\n");
+}
+
 /*
  * printresults - prints a performance summary for some malloc package
  */
@@ -973,6 +2274,123 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printmemory - prints, for each trace, the peak heap size next to the
+ *     heap size and the resident part of the heap once the trace ends
+ */
+static void printmemory(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%5s%10s%10s%10s\n", "trace", "peak kB", "heap kB", "rss kB");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid)
+	    printf("%2d%13.1f%10.1f%10.1f\n",
+		   i,
+		   stats[i].peak / 1024.0,
+		   stats[i].heap / 1024.0,
+		   stats[i].resident / 1024.0);
+	else
+	    printf("%2d%13s%10s%10s\n", i, "-", "-", "-");
+    }
+}
+
+/*
+ * printevents - prints the counter deltas of each trace, divided by its
+ *     number of requests if per_op is set, and the same over all traces
+ */
+static void printevents(int n, stats_t *stats, int per_op)
+{
+    long long total[NUM_EVENTS];
+    double ops = 0;
+    int i, e;
+
+    printf("%5s", "trace");
+    for (e = 0; e < NUM_EVENTS; e++)
+	printf("%*s", per_op ? 10 : 13, event_names[e]);
+    printf("\n");
+    for (e = 0; e < NUM_EVENTS; e++)
+	total[e] = 0;
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid)
+	    continue;
+	printf("%2d   ", i);
+	for (e = 0; e < NUM_EVENTS; e++) {
+	    if (stats[i].events[e] < 0)
+		printf("%*s", per_op ? 10 : 13, "-");
+	    else if (per_op)
+		printf("%10.2f", stats[i].events[e] / stats[i].ops);
+	    else
+		printf("%13lld", stats[i].events[e]);
+	    if (stats[i].events[e] < 0 || total[e] < 0)
+		total[e] = -1;
+	    else
+		total[e] += stats[i].events[e];
+	}
+	printf("\n");
+	ops += stats[i].ops;
+    }
+    printf("Total");
+    for (e = 0; e < NUM_EVENTS; e++) {
+	if (total[e] < 0 || ops == 0)
+	    printf("%*s", per_op ? 10 : 13, "-");
+	else if (per_op)
+	    printf("%10.2f", total[e] / ops);
+	else
+	    printf("%13lld", total[e]);
+    }
+    printf("\n");
+}
+
+/*
+ * printlatency - prints the median, tail percentiles and maximum of
+ *     each request type in each trace
+ */
+static void printlatency(int n, stats_t *stats)
+{
+    hist_t *hist;
+    int i, t;
+
+    printf("%5s%9s%9s%8s%8s%8s%10s\n",
+	   "trace", "request", "count", "p50", "p99", "p99.9", "max");
+    for (i = 0; i < n; i++) {
+	if (stats[i].lat == NULL)
+	    continue;
+	for (t = 0; t < NUM_TYPES; t++) {
+	    hist = &stats[i].lat[t];
+	    if (hist->n == 0)
+		continue;
+	    printf("%2d%12s%9lu%8llu%8llu%8llu%10llu\n",
+		   i, op_names[t], hist->n,
+		   hist_quantile(hist, 0.5),
+		   hist_quantile(hist, 0.99),
+		   hist_quantile(hist, 0.999),
+		   hist->max);
+	}
+    }
+}
+
+/*
+ * dumplatency - writes the non-empty histogram buckets as CSV rows
+ */
+static void dumplatency(FILE *fp, char *package, int n, stats_t *stats)
+{
+    hist_t *hist;
+    int i, t, b;
+
+    for (i = 0; i < n; i++) {
+	if (stats[i].lat == NULL)
+	    continue;
+	for (t = 0; t < NUM_TYPES; t++) {
+	    hist = &stats[i].lat[t];
+	    for (b = 0; b < LAT_BUCKETS; b++)
+		if (hist->count[b] > 0)
+		    fprintf(fp, "%s,%d,%s,%llu,%llu,%lu\n", package, i, op_names[t],
+			    bucket_lo(b), bucket_lo(b + 1) - 1, hist->count[b]);
+	}
+    }
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -1005,14 +2423,23 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValPLCB] [-f <file>] [-t <dir>] [-T <n,...>] [-c <csv>]\n"
+	    "               [-s <n>] [-o <base>]\n");
     fprintf(stderr, "Options\n");
 //    fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-B         Time batches against the same requests one by one.\n");
+    fprintf(stderr, "\t-C         Read performance counters around the speed runs.\n");
+    fprintf(stderr, "\t-c <csv>   Write the latency histograms of -L to <csv>.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-o <base>  Write the -s samples to <base>.csv and <base>.map.\n");
+    fprintf(stderr, "\t-L         Time each request; print latency percentiles.\n");
+    fprintf(stderr, "\t-s <n>     Walk the heap every <n> requests; see -o.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <n,...> Also replay the traces on n threads each.\n");
+    fprintf(stderr, "\t-P         In that replay, free blocks on another thread.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
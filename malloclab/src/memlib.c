@@ -2,36 +2,71 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ * One mapping is reserved for MAX_REGIONS heaps of MAX_HEAP bytes each,
+ * laid out back to back, so a multi-arena package can give every arena
+ * its own brk. Region 0 is the classic heap of mem_sbrk and mem_heap_lo.
+ * A heap can shrink as well as grow; the pages it gives up, like any
+ * range passed to mem_discard, go back to the kernel. Unlike sbrk, a
+ * heap does not always grow by zeroed memory: mem_reset_brk leaves the
+ * data of the driver's earlier runs in place. mem_region_dirty tells a
+ * package where the memory that may hold data ends.
+ *
+ * Besides the heaps, a package may map chunks of its own with mem_map,
+ * e.g. for very large blocks. They are tracked so that mem_contains and
+ * the heap size statistics take them into account.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "memlib.h"
 #include "config.h"
 
 /* private variables */
 static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static char *mem_brk[MAX_REGIONS];  /* points to last byte of each region */
+static char *mem_dirty[MAX_REGIONS];/* end of the memory that may not be zero */
+static size_t mem_peak;             /* highest mem_heapsize() since reset */
+
+/* chunks handed out by mem_map */
+typedef struct {
+    char *lo;
+    size_t len;
+} chunk_t;
+
+static chunk_t *mem_chunks;         /* mapped chunks, in no particular order */
+static int mem_nchunks, mem_maxchunks;
+static size_t mem_mapped;           /* bytes in mapped chunks */
+static pthread_mutex_t mem_chunk_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void update_peak(void);
+
+#define PAGE_UP(p) ((char *)(((uintptr_t)(p) + mem_pagesize() - 1) & ~(uintptr_t)(mem_pagesize() - 1)))
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    /* reserve the storage we will use to model the available VM */
+    mem_start_brk = mmap(NULL, (size_t)MAX_REGIONS * MAX_HEAP, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem_start_brk == MAP_FAILED) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
+    for (int i = 0; i < MAX_REGIONS; i++)
+        mem_dirty[i] = mem_region_lo(i);
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
+    mem_reset_brk();                          /* heap is empty initially */
 }
 
 /* 
@@ -39,35 +74,248 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    mem_reset_brk();
+    munmap(mem_start_brk, (size_t)MAX_REGIONS * MAX_HEAP);
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap,
+ *    and unmap every chunk still mapped
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    int i;
+
+    for (i = 0; i < MAX_REGIONS; i++)
+        mem_brk[i] = mem_start_brk + (size_t)i * MAX_HEAP;
+
+    pthread_mutex_lock(&mem_chunk_lock);
+    for (i = 0; i < mem_nchunks; i++)
+        munmap(mem_chunks[i].lo, mem_chunks[i].len);
+    mem_nchunks = 0;
+    mem_mapped = 0;
+    mem_peak = 0;
+    pthread_mutex_unlock(&mem_chunk_lock);
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area. A
+ *    negative incr shrinks the heap and discards the pages it leaves.
  */
 void *mem_sbrk(int incr) 
 {
-    char *old_brk = mem_brk;
+    return mem_region_sbrk(0, incr);
+}
+
+/*
+ * mem_region_sbrk - mem_sbrk for the heap in the given region
+ */
+void *mem_region_sbrk(int region, int incr)
+{
+    char *old_brk = mem_brk[region];
+    char *dirty;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    if ((old_brk + incr) < (char *)mem_region_lo(region)) {
+	errno = EINVAL;
+	fprintf(stderr, "ERROR: mem_sbrk failed. Heap shrunk below its start...\n");
+	return (void *)-1;
+    }
+    if ((old_brk + incr) > (char *)mem_region_lo(region) + MAX_HEAP) {
 	errno = ENOMEM;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
-    mem_brk += incr;
+    mem_brk[region] += incr;
+    if (incr < 0) {
+        /* the pages above the dirty end are zero already */
+        dirty = PAGE_UP(mem_dirty[region]);
+        mem_discard(mem_brk[region], dirty - mem_brk[region]);
+        if (PAGE_UP(mem_brk[region]) < dirty)
+            mem_dirty[region] = PAGE_UP(mem_brk[region]);
+    } else {
+        if (mem_brk[region] > mem_dirty[region])
+            mem_dirty[region] = mem_brk[region];
+        update_peak();
+    }
     return (void *)old_brk;
 }
 
+/*
+ * mem_region_dirty - end of the memory in region that may hold data:
+ *    the highest brk since the region's pages last went back to the
+ *    kernel. Memory from there on reads as zeros
+ */
+void *mem_region_dirty(int region)
+{
+    return mem_dirty[region];
+}
+
+/*
+ * update_peak - note the current heap size if it is a new peak; an
+ *    update racing with another thread's growth may be lost
+ */
+static void update_peak(void)
+{
+    size_t size = mem_heapsize();
+
+    if (size > mem_peak)
+        mem_peak = size;
+}
+
+/*
+ * mem_discard - give the whole pages in [addr, addr+len) back to the
+ *    kernel; they read as zeros when next touched
+ */
+void mem_discard(void *addr, size_t len)
+{
+    uintptr_t page = mem_pagesize();
+    uintptr_t lo = ((uintptr_t)addr + page - 1) & ~(page - 1);
+    uintptr_t hi = ((uintptr_t)addr + len) & ~(page - 1);
+
+    if (lo < hi)
+        madvise((void *)lo, hi - lo, MADV_DONTNEED);
+}
+
+/*
+ * find_chunk - index of the mapped chunk starting at lo, or -1;
+ *    the caller holds mem_chunk_lock
+ */
+static int find_chunk(void *lo)
+{
+    int i;
+
+    for (i = 0; i < mem_nchunks; i++)
+        if (mem_chunks[i].lo == lo)
+            return i;
+    return -1;
+}
+
+/*
+ * mem_map - map a chunk of len bytes outside the heaps, or return NULL
+ */
+void *mem_map(size_t len)
+{
+    chunk_t *chunks;
+    void *p;
+
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    pthread_mutex_lock(&mem_chunk_lock);
+    if (mem_nchunks == mem_maxchunks) {
+        mem_maxchunks = mem_maxchunks ? 2 * mem_maxchunks : 64;
+        if ((chunks = realloc(mem_chunks, mem_maxchunks * sizeof(chunk_t))) == NULL) {
+            pthread_mutex_unlock(&mem_chunk_lock);
+            munmap(p, len);
+            return NULL;
+        }
+        mem_chunks = chunks;
+    }
+    mem_chunks[mem_nchunks].lo = p;
+    mem_chunks[mem_nchunks].len = len;
+    mem_nchunks++;
+    mem_mapped += len;
+    pthread_mutex_unlock(&mem_chunk_lock);
+    update_peak();
+    return p;
+}
+
+/*
+ * mem_remap - resize the mapped chunk at p to len bytes, moving it if
+ *    need be, and return its new address or NULL
+ */
+void *mem_remap(void *p, size_t len)
+{
+    void *q;
+    int i;
+
+    pthread_mutex_lock(&mem_chunk_lock);
+    if ((i = find_chunk(p)) < 0 ||
+        (q = mremap(p, mem_chunks[i].len, len, MREMAP_MAYMOVE)) == MAP_FAILED) {
+        pthread_mutex_unlock(&mem_chunk_lock);
+        return NULL;
+    }
+    mem_mapped += len - mem_chunks[i].len;
+    mem_chunks[i].lo = q;
+    mem_chunks[i].len = len;
+    pthread_mutex_unlock(&mem_chunk_lock);
+    update_peak();
+    return q;
+}
+
+/*
+ * mem_unmap - unmap the chunk at p
+ */
+void mem_unmap(void *p)
+{
+    int i;
+
+    pthread_mutex_lock(&mem_chunk_lock);
+    if ((i = find_chunk(p)) >= 0) {
+        munmap(p, mem_chunks[i].len);
+        mem_mapped -= mem_chunks[i].len;
+        mem_chunks[i] = mem_chunks[--mem_nchunks];
+    }
+    pthread_mutex_unlock(&mem_chunk_lock);
+}
+
+/*
+ * mem_contains - is [lo, lo+len) inside one heap or one mapped chunk?
+ */
+int mem_contains(void *lo, size_t len)
+{
+    char *p = lo;
+    int i, found = 0;
+
+    if ((i = mem_region_of(p)) >= 0)
+        return p + len <= mem_brk[i] && p + len >= p;
+
+    pthread_mutex_lock(&mem_chunk_lock);
+    for (i = 0; i < mem_nchunks && !found; i++)
+        found = p >= mem_chunks[i].lo && p + len <= mem_chunks[i].lo + mem_chunks[i].len;
+    pthread_mutex_unlock(&mem_chunk_lock);
+    return found;
+}
+
+/*
+ * mem_region_lo - return address of the first byte of a region
+ */
+void *mem_region_lo(int region)
+{
+    return mem_start_brk + (size_t)region * MAX_HEAP;
+}
+
+/*
+ * mem_region_size - returns the heap size of a region in bytes
+ */
+size_t mem_region_size(int region)
+{
+    return (size_t)(mem_brk[region] - (char *)mem_region_lo(region));
+}
+
+/*
+ * mem_region_of - returns the region holding address p, or -1
+ */
+int mem_region_of(void *p)
+{
+    size_t off = (char *)p - mem_start_brk;
+
+    if ((char *)p < mem_start_brk || off >= (size_t)MAX_REGIONS * MAX_HEAP)
+        return -1;
+    return off / MAX_HEAP;
+}
+
+/*
+ * mem_regions - returns the number of regions
+ */
+int mem_regions()
+{
+    return MAX_REGIONS;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -81,15 +329,69 @@ void *mem_heap_lo()
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return (void *)(mem_brk[0] - 1);
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_heapsize() - returns the heap size in bytes, summed over all regions
+ *    and mapped chunks
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    size_t size = mem_mapped;
+    int i;
+
+    for (i = 0; i < MAX_REGIONS; i++)
+        size += mem_region_size(i);
+    return size;
+}
+
+/*
+ * mem_mapsize() - returns the bytes in chunks mapped with mem_map
+ */
+size_t mem_mapsize()
+{
+    return mem_mapped;
+}
+
+/*
+ * mem_heap_peak() - returns the largest mem_heapsize() since the last
+ *    mem_reset_brk
+ */
+size_t mem_heap_peak()
+{
+    return mem_peak;
+}
+
+/*
+ * mem_resident() - returns the bytes of the heaps that are resident in
+ *    memory, i.e. touched and not discarded since
+ */
+size_t mem_resident()
+{
+    static unsigned char *vec;
+    size_t page = mem_pagesize();
+    size_t pages, resident = 0, j;
+    int i;
+
+    if (vec == NULL && (vec = malloc(MAX_HEAP / page + 1)) == NULL)
+        return 0;
+    for (i = 0; i < MAX_REGIONS; i++) {
+        pages = (mem_region_size(i) + page - 1) / page;
+        if (pages == 0 || mincore(mem_region_lo(i), pages * page, vec) < 0)
+            continue;
+        for (j = 0; j < pages; j++)
+            resident += (vec[j] & 1) * page;
+    }
+
+    /* mapped chunks, a page at a time as they may be larger than vec */
+    pthread_mutex_lock(&mem_chunk_lock);
+    for (i = 0; i < mem_nchunks; i++)
+        for (j = 0; j < mem_chunks[i].len; j += page)
+            if (mincore(mem_chunks[i].lo + j, page, vec) == 0)
+                resident += (vec[0] & 1) * page;
+    pthread_mutex_unlock(&mem_chunk_lock);
+    return resident;
 }
 
 /*
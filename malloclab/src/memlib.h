@@ -6,6 +6,20 @@ void *mem_sbrk(int incr);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
+void *mem_region_sbrk(int region, int incr);
+void *mem_region_lo(int region);
+size_t mem_region_size(int region);
+void *mem_region_dirty(int region);
+int mem_region_of(void *p);
+int mem_regions(void);
+void mem_discard(void *addr, size_t len);
+void *mem_map(size_t len);
+void *mem_remap(void *p, size_t len);
+void mem_unmap(void *p);
+int mem_contains(void *lo, size_t len);
 size_t mem_heapsize(void);
+size_t mem_mapsize(void);
+size_t mem_heap_peak(void);
+size_t mem_resident(void);
 size_t mem_pagesize(void);
 
@@ -1,35 +1,143 @@
 /*
  * 2017-19651 
  * mm.c - implemented with segregated list and best fit strategy
+ *
+ * Headers, footers and seglist links are 4-byte words on both 32- and
+ * 64-bit hosts: links hold offsets from the start of the heap instead of
+ * pointers, with offset 0 meaning NULL, so a free block needs only 16 bytes.
+ * Only free blocks carry a footer; each header records in bit 1 whether
+ * the previous block is allocated, which is all coalesce() needs.
+ *
+ * Free blocks are indexed TLSF-style: a first level per power of two,
+ * split into SL_COUNT linear second-level classes, each an unsorted
+ * list. A bitmap per level marks the non-empty lists, so find_fit looks
+ * at the request's own class and then jumps to the next non-empty larger
+ * class with a couple of bit scans. Free blocks of TREE_MIN bytes and
+ * more are kept out of the lists in a treap inside the blocks, ordered
+ * by size and then address, so a large request gets the exact best fit
+ * in O(log n). The treap needs no balance field: a block's priority is
+ * a hash of its offset.
+ *
+ * The package is thread-safe. Each memlib region holds one arena: a
+ * header with the arena's lock and free-list index, then its own heap.
+ * Threads are spread over the arenas round-robin and free a block into
+ * the arena whose region contains it. Once a second thread shows up,
+ * every thread also keeps a few recently freed small blocks of its own
+ * arena per size in front of it (still marked allocated, so not
+ * coalesced) and hands them out again without taking any lock. Blocks
+ * of other arenas go straight back to them.
+ *
+ * Each arena also defers coalescing of small blocks: a freed block of
+ * up to QUICK_MAX bytes stays marked allocated on a LIFO quick list of
+ * its exact size, where the next request of that size finds it. The
+ * quick lists are emptied into the free-list index, coalescing as
+ * usual, once they hold QUICK_LIMIT blocks or when no free block fits
+ * a request.
+ *
+ * Requests of up to SLAB_MAX bytes do not get a block of their own.
+ * They are served from runs: page-aligned RUN_SIZE blocks of the heap,
+ * each cut into objects of one size class with no per-object header,
+ * plus a run header holding a bitmap of the objects in use. Runs with
+ * free objects are listed per class in the arena, and a bitmap of the
+ * region's pages marking runs lets mm_free tell a small object from a
+ * block and find its run by masking the address to the page.
+ *
+ * Freed memory also goes back to the system: a large free block at the
+ * top of an arena shrinks its heap, and a very large one elsewhere has
+ * its pages discarded. When memory given back is taken again within a
+ * few requests per page, the limit rises to twice what was given back,
+ * and it falls back when what it held back goes unused for long. The
+ * limits live in the arena header, so mm_init starts them over.
+ *
+ * Batches take the arena lock once. mm_malloc_batch cuts its blocks
+ * out of one free span where it can, writing only their headers, and
+ * mm_free_batch sorts its blocks by address so that neighbours in the
+ * batch become one block before they are freed and coalesced.
+ *
+ * mm_memalign splits the slack in front of an aligned block off as a
+ * free block, and mm_calloc skips clearing heap memory that memlib
+ * reports as unwritten since its pages were last discarded. Given the
+ * size of a small block, mm_free_sized puts it in the thread cache
+ * without reading its header, or a slab object back in its run without
+ * reading the run's object size.
+ *
+ * Requests of MMAP_MIN bytes and more stay out of the arenas. Each gets
+ * a memlib mapping of its own, with the block's header word, holding
+ * the mapping's length, just before the payload. mm_free unmaps it and
+ * mm_realloc resizes it with mremap, so a huge block is never copied.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "mm.h"
 #include "memlib.h"
+#include "config.h"
 
-/* single word (4) or double word (8) alignment */
+/* double word (8) or quad word (16) alignment, set with -DALIGNMENT */
+#ifndef ALIGNMENT
 #define ALIGNMENT 8
+#endif
 
 /* rounds up to the nearest multiple of ALIGNMENT */
-#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(ALIGNMENT-1))
 #define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
 
+/* requests this large get a mapping of their own, set with -DMMAP_MIN */
+#ifndef MMAP_MIN
+#define MMAP_MIN (1 << 18)
+#endif
+
 /* Basic constants and macros */
 #define WSIZE   4               /* Word and header/footer size (bytes) */
 #define DSIZE   8               /* Double word size (bytes) */
 #define CHUNKSIZE (1<<6)        /* Extend heap by this amount (bytes) */
 #define DCHUNKSIZE (1<<12)
-#define SEG_SIZE 24             /* Maximum segregated list count */
+#define SL_SHIFT 3              /* log2 of second-level classes per power of two */
+#define SL_COUNT (1 << SL_SHIFT)
+#define FL_SHIFT (SL_SHIFT + 3) /* sizes below 1 << FL_SHIFT share first level 0 */
+#define FL_COUNT (32 - FL_SHIFT + 1)
+#define SEG_SIZE (FL_COUNT * SL_COUNT)  /* Segregated list count */
+#define FIT_SCAN 8              /* blocks examined in the request's own class */
+#define TREE_MIN (1 << 16)      /* free blocks this large go in the treap */
 #define MAX(x, y) ((x) > (y)?  (x) : (y))
+#define MIN(x, y) ((x) < (y)?  (x) : (y))
 #define MINSIZE 200             /* Size limitation for efficiency */
+#define MIN_BLOCK ALIGN(4*WSIZE) /* header, two links and footer */
+#define TC_MAX_SIZE 256         /* largest block size kept in a thread cache */
+#define TC_BINS (TC_MAX_SIZE / ALIGNMENT + 1)
+#define TC_COUNT 7              /* blocks per thread cache bin */
+#define QUICK_MAX 256           /* largest block size kept on a quick list */
+#define QUICK_BINS ((QUICK_MAX - SLAB_MAX) / ALIGNMENT)
+#define QUICK_BIN(size) (((size) - SLAB_MAX - 1) / ALIGNMENT)
+#define QUICK_LIMIT 16          /* quick blocks held before coalescing them */
+#define TRIM_MAX (1 << 18)      /* a free top block this large shrinks the heap... */
+#define TRIM_PAD (1 << 16)      /* ...down to this much, so regrowth needs no sbrk */
+#define DISCARD_MIN (1 << 20)   /* interior free blocks this large drop their pages */
+#define RELEASE_WAIT 32         /* requests per page given back before regrowth is cheap */
+#define GROW_SHIFT 4            /* regrown blocks get 1/16 of their size spare */
+#ifndef CHECK
+#define CHECK 0                 /* blocks mm_check_slice checks per request, -1: mm_check */
+#endif
+#define RUN_SIZE 4096           /* size and alignment of a slab run */
+#define SLAB_MAX 64             /* largest request served from runs */
+#define SLAB_STEP 16            /* spacing of the slab size classes */
+#define SLAB_CLASSES (SLAB_MAX / SLAB_STEP)
+#define SLAB_CLASS(size) (((size) - 1) / SLAB_STEP)
+#define RUN_MAP_WORDS (RUN_SIZE / SLAB_STEP / 32)
 
-/* Pack a size and allocated bit into a word */
+/* Pack a size and allocated bits into a word */
 #define PACK(size, alloc) ((size) | (alloc))
+#define PREV_ALLOC 0x2          /* header bit: previous block is allocated */
+#define QUICK 0x4               /* header bit: allocated block on a quick list */
+#define DISCARDED 0x4           /* header bit: free block whose pages were discarded */
 
 /* Read and write a word at address p */
 #define GET(p)      (*(unsigned int *)(p))
@@ -38,39 +146,159 @@
 /* Read the size and allocated fields from address */
 #define GET_SIZE(p)     (GET(p) & ~0x7)
 #define GET_ALLOC(p)    (GET(p) & 0x1)
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
 
 /* Given block ptr bp, compute address of its header and footer */
 #define HDRP(bp)    ((char *)(bp) - WSIZE)
 #define FTRP(bp)    ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 
-/* Given block ptr bp, compute address of next and previous blocks */
+/* Given block ptr bp, compute address of next and previous blocks
+   (PREV_BLKP only when the previous block is free and has a footer) */
 #define NEXT_BLKP(bp)   ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
 #define PREV_BLKP(bp)   ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
 
-/* Helper macros for segregated list */
-#define GET_VAL(ptr)        ((char **)(ptr))
-#define UNSIGN(p)           ((unsigned int)(p))
+/* Convert between block pointers and 4-byte heap offsets (0 is NULL) */
+#define UNSIGN(p)           ((p) ? (unsigned int)((char *)(p) - heap_base) : 0)
+#define ADDR(off)           ((off) ? (void *)(heap_base + (off)) : NULL)
+
+/* Helper macros for segregated list of the locked arena */
 #define GET_BLK_SIZE(ptr)   (GET_SIZE(HDRP(ptr)))
-#define SET_SEG_LIST_PTR(ptr, idx, val)  (*(GET_VAL(ptr) + idx) = val)
-#define GET_SEG_LIST_PTR(ptr, idx) (*(GET_VAL(ptr) + idx))
+#define SET_SEG_LIST_PTR(ptr, idx, val)  PUT((char *)(ptr) + (idx)*WSIZE, UNSIGN(val))
+#define GET_SEG_LIST_PTR(ptr, idx) ADDR(GET((char *)(ptr) + (idx)*WSIZE))
+#define SEG_INDEX(fl, sl)   ((fl) * SL_COUNT + (sl))
+#define seg_list_ptr        (arena->seg_list)
+#define heap_ptr            (arena->prologue)
+
+/* Bitmaps of non-empty lists */
+#define FL_BITMAP           (&arena->fl_bitmap)
+#define SL_BITMAP(fl)       (&arena->sl_bitmap[fl])
 #define GET_SEG_PREV_ADR(bp)    ((char *)(bp))
 #define GET_SEG_NEXT_ADR(bp)    ((char *)(bp) + WSIZE)
-#define SEG_PREV_BLKP(bp)    (*(GET_VAL(bp)))
-#define SEG_NEXT_BLKP(bp)    (*(GET_VAL(GET_SEG_NEXT_ADR(bp))))
+#define SEG_PREV_BLKP(bp)    ADDR(GET(GET_SEG_PREV_ADR(bp)))
+#define SEG_NEXT_BLKP(bp)    ADDR(GET(GET_SEG_NEXT_ADR(bp)))
+
+/* Treap links of a large free block, in place of the list links */
+#define TREE_LEFT(bp)       ((char *)(bp))
+#define TREE_RIGHT(bp)      ((char *)(bp) + WSIZE)
+#define TREE_PRIO(off)      ((unsigned int)(off) * 2654435761U)
+#define TREE_LESS(a, b)     (GET_BLK_SIZE(a) < GET_BLK_SIZE(b) || \
+                             (GET_BLK_SIZE(a) == GET_BLK_SIZE(b) && (char *)(a) < (char *)(b)))
+
+/* Trim and discard limits of an arena */
+typedef struct {
+    unsigned int trim_max;              /* free top block size that shrinks the heap */
+    unsigned int trimmed;               /* bytes trimmed since the heap last grew */
+    unsigned int discard_min;           /* free block size that drops its pages */
+    unsigned int discarded;             /* bytes dropped since the heap last grew */
+    unsigned int kept;                  /* largest block held back by a raised limit */
+    unsigned int requests;              /* requests since the last of those */
+} limits_t;
+
+/* Arena header, at the start of its memlib region */
+typedef struct {
+    pthread_mutex_t lock;
+    int region;                         /* memlib region of this arena */
+    char *prologue;                     /* prologue block */
+    unsigned int fl_bitmap;             /* non-empty first levels */
+    unsigned int sl_bitmap[FL_COUNT];   /* non-empty classes per first level */
+    unsigned int seg_list[SEG_SIZE];    /* list heads as heap offsets */
+    unsigned int tree_root;             /* treap of large free blocks */
+    unsigned int quick[QUICK_BINS];     /* quick list heads by block size */
+    unsigned int quick_count;           /* blocks on the quick lists */
+    unsigned int quick_map;             /* non-empty quick lists */
+    unsigned int last_grown;            /* block last grown by realloc */
+    unsigned int run_list[SLAB_CLASSES];    /* runs with free objects */
+    unsigned int run_map;               /* offset of the bitmap of pages that are runs */
+    unsigned int check_next;            /* next block mm_check_slice looks at */
+    unsigned int check_class;           /* next list class mm_check_slice looks at */
+    limits_t limits;                    /* when release gives memory back */
+} arena_t;
+
+/* Slab run header, at the start of its page */
+typedef struct {
+    unsigned short size;                /* object size */
+    unsigned short count;               /* objects in the run */
+    unsigned short used;                /* objects handed out */
+    unsigned int prev, next;            /* run_list links as heap offsets */
+    unsigned int map[RUN_MAP_WORDS];    /* bit set: object in use */
+} run_t;
+
+#define RUN_HDR         ALIGN(sizeof(run_t))
+#define ARENA_OF(bp)    ((arena_t *)mem_region_lo(mem_region_of(bp)))
+#define RUN_OF(bp)      ((run_t *)((uintptr_t)(bp) & ~(uintptr_t)(RUN_SIZE - 1)))
+#define PAGE_INDEX(a, p) ((size_t)((char *)(p) - (char *)(a)) / RUN_SIZE)
+#define RUN_MAP_SIZE    (MAX_HEAP / RUN_SIZE / 8)
+#define RUN_MAP(a)      ((unsigned char *)ADDR((a)->run_map))
+#define MAPPED(bp)      (mem_region_of(bp) < 0)
+#define MAP_LEN(size)   (((size) + ALIGNMENT + mem_pagesize() - 1) & ~(mem_pagesize() - 1))
+#define IS_RUN(a, p)    ((a)->run_map != 0 && \
+                         (RUN_MAP(a)[PAGE_INDEX(a, p) / 8] >> (PAGE_INDEX(a, p) % 8)) & 1)
+#define LIMITS          (&arena->limits)
 
 /* Global pointer */
-static char *heap_ptr = 0;          /* pointer for heap */
-static void *seg_list_ptr;          /* pointer for segregated list*/
+static char *heap_base = 0;         /* start of the heap, origin of offsets */
+static int generation = 0;          /* bumped by mm_init, stales thread state */
+static int next_thread = 0;         /* hands out arenas round-robin */
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t tcache_key;
+static unsigned long lock_waits;    /* arena locks found held by another thread */
+static unsigned long lock_wait_ns;  /* time spent waiting for them */
+
+/* Per-thread state */
+static __thread arena_t *arena;     /* arena whose lock this thread holds */
+static __thread arena_t *home;      /* arena this thread allocates from */
+static __thread int thread_index = -1;
+static __thread int home_generation;
+static __thread void *tc_head[TC_BINS];   /* cached blocks, linked through the payload */
+static __thread int tc_count[TC_BINS];
 
 /* Helper functions */
 static void *extend_heap(size_t words);
 static void *coalesce(void *bp);
-static void *find_fit(size_t asize, size_t csize, int index);
+static void *find_fit(size_t asize);
+static void mapping(size_t size, int *fl, int *sl);
 static void *place(void *bp, size_t asize);
+static void *place_aligned(void *bp, size_t asize, size_t alignment);
+static void *block_alloc(size_t asize);
+static int carve(void *bp, size_t asize, int n, void **out);
+static void *quick_alloc(size_t asize);
+static int by_address(const void *a, const void *b);
 static void init_seglist(void);
+static arena_t *init_arena(int region);
+static arena_t *get_home(void);
+static void free_block(void *bp);
+static void quick_flush(void);
+static void release(void *bp);
+static void arena_free(arena_t *a, void *bp, size_t size);
+static int tc_put(arena_t *a, void *bp, size_t size);
+static void arena_lock(arena_t *a);
+static void arena_unlock(arena_t *a);
+static void *slab_alloc(size_t size);
+static void slab_free(run_t *run, void *bp, size_t size);
+static run_t *new_run(size_t size);
+static run_t *carve_run(void *bp);
+static void add_run(run_t *run);
+static void remove_run(run_t *run);
+static void *realloc_in_place(void *ptr, size_t size, int grown);
+static void *map_alloc(size_t size);
+static void *map_resize(void *ptr, size_t size);
+static void tcache_flush(void *unused);
+static void make_tcache_key(void);
 static void add_seglist(void *bp, size_t blk_size);
+static unsigned int tree_insert(unsigned int root, void *bp);
+static unsigned int tree_remove(unsigned int root, void *bp);
+static unsigned int tree_merge(unsigned int left, unsigned int right);
+static void *tree_fit(size_t asize);
+static int tree_check(unsigned int root, size_t *count);
+static int check_block(void *bp);
+static int check_epilogue(void *bp);
+static int check_class(int idx);
+static void check_merged(void *bp);
 static void remove_seglist(void *bp);
+static void write_block(void *bp, size_t size, unsigned int prev_alloc, int alloc);
+static void set_prev_alloc(void *bp, int alloc);
 static int mm_check(void);
+static int mm_check_slice(int n);
 
 /* 
  * mm_init - initialize the malloc package.
@@ -78,25 +306,76 @@ static int mm_check(void);
  */
 int mm_init(void)
 {
-    init_seglist();
-    
-    /* Create the initial empty heap */
-    if ((heap_ptr = mem_sbrk(4*WSIZE)) == (void *)-1)
-        return -1;
-        
-    PUT(heap_ptr, 0);                             /* Alignment padding */
-    PUT(heap_ptr + (1*WSIZE), PACK(DSIZE, 1));    /* Prologue header */
-    PUT(heap_ptr + (2*WSIZE), PACK(DSIZE, 1));    /* Prologure header */
-    PUT(heap_ptr + (3*WSIZE), PACK(0, 1));        /* Epilogue header */
-    heap_ptr += (2*WSIZE);
-    
-    /* Extend the empty heap with a free block of CHUNKSIZE bytes */
-    if (extend_heap(CHUNKSIZE/WSIZE) == NULL)
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+    pthread_once(&once, make_tcache_key);
+    heap_base = mem_heap_lo();
+    generation++;
+    lock_waits = lock_wait_ns = 0;
+    if (init_arena(0) == NULL)
         return -1;
-    
     return 0;
 }
 
+/*
+ * init_arena - set up the arena of a memlib region the first time it
+ *     is used: header, prologue, epilogue and a first free block
+ */
+static arena_t *init_arena(int region)
+{
+    arena_t *a = mem_region_lo(region);
+
+    pthread_mutex_lock(&init_lock);
+    if (mem_region_size(region) == 0) {
+        if (mem_region_sbrk(region, ALIGN(sizeof(arena_t))) == (void *)-1) {
+            pthread_mutex_unlock(&init_lock);
+            return NULL;
+        }
+        pthread_mutex_init(&a->lock, NULL);
+        a->region = region;
+        arena = a;
+        init_seglist();
+
+        /* Create the initial empty heap */
+        if ((heap_ptr = mem_region_sbrk(region, 2*ALIGNMENT)) == (void *)-1) {
+            pthread_mutex_unlock(&init_lock);
+            return NULL;
+        }
+        memset(heap_ptr, 0, ALIGNMENT);                          /* Alignment padding */
+        heap_ptr += ALIGNMENT;
+        PUT(HDRP(heap_ptr), PACK(ALIGNMENT, PREV_ALLOC | 1));    /* Prologue header */
+        PUT(HDRP(NEXT_BLKP(heap_ptr)), PACK(0, PREV_ALLOC | 1)); /* Epilogue header */
+
+        /* Extend the empty heap with a free block of CHUNKSIZE bytes */
+        if (extend_heap(CHUNKSIZE/WSIZE) == NULL) {
+            pthread_mutex_unlock(&init_lock);
+            return NULL;
+        }
+    }
+    pthread_mutex_unlock(&init_lock);
+    return a;
+}
+
+/*
+ * get_home - this thread's arena; after mm_init, forget the blocks
+ *     cached from the old heap and pick the arena again
+ */
+static arena_t *get_home(void)
+{
+    if (home_generation != generation) {
+        memset(tc_head, 0, sizeof(tc_head));
+        memset(tc_count, 0, sizeof(tc_count));
+        home = NULL;
+        home_generation = generation;
+    }
+    if (home == NULL) {
+        if (thread_index < 0)
+            thread_index = __sync_fetch_and_add(&next_thread, 1);
+        home = init_arena(thread_index % mem_regions());
+    }
+    return home;
+}
+
 /* 
  * mm_malloc - Allocate a block by incrementing the brk pointer.
  *     Always allocate a block whose size is a multiple of the alignment.
@@ -105,455 +384,1660 @@ int mm_init(void)
 void *mm_malloc(size_t size)
 {
     size_t asize;            /* Adjusted block size */
-    size_t extendsize;       /* Amount to extend heap if no fit */
     char *bp;
+    arena_t *a;
 
     /* Ignore spurious requests */
     if (size <= 0)
         return NULL;
+    if (size >= MMAP_MIN)
+        return map_alloc(size);
        
-    /* Adjust block size to include overhead and alignment reqs */
-    if (size <= 2*DSIZE)
-         asize = 3*DSIZE;
+    /* Adjust block size to include overhead and alignment reqs;
+       small requests take an object of their class size instead */
+    if (size <= SLAB_MAX)
+        asize = (SLAB_CLASS(size) + 1) * SLAB_STEP;
     else
-         asize = ALIGN(size + DSIZE);
+        asize = MAX(ALIGN(size + WSIZE), MIN_BLOCK);
 
-    /* Search the free list for a fit */
-    if ((bp = find_fit(asize, asize, 0)) != NULL) {
-        return place(bp, asize);
-    }
-    
-    /* No fit found. Get more memory and place the block */
-    extendsize = MAX(asize, DCHUNKSIZE);
-    if ((bp = extend_heap(extendsize/WSIZE)) == NULL)
+    if ((a = get_home()) == NULL)
         return NULL;
 
-    return place(bp, asize);
+    /* Reuse a block this thread freed recently */
+    if (asize <= TC_MAX_SIZE && (bp = tc_head[asize / ALIGNMENT]) != NULL) {
+        tc_head[asize / ALIGNMENT] = *(void **)bp;
+        tc_count[asize / ALIGNMENT]--;
+        return bp;
+    }
+
+    arena_lock(a);
+    arena = a;
+
+    if (size <= SLAB_MAX)
+        bp = slab_alloc(asize);
+    else if ((bp = quick_alloc(asize)) == NULL)
+        bp = block_alloc(asize);
+
+    arena_unlock(a);
+    return bp;
 }
 
 /*
- * mm_free - Freeing a block does nothing.
- * then 
- *  1) insert into the segregated list
- *  2) coalesce
- * referenced the textbook
+ * mm_malloc_batch - allocate n blocks of size bytes into out[] under
+ *     one lock: slab objects one after another, otherwise blocks off
+ *     the quick list of their size and then whole spans, each cut into
+ *     as many blocks as it holds in a single pass. A span that holds
+ *     all of them is preferred to the best fit for one, and the heap
+ *     grows by all of them at once. Returns the number of blocks
+ *     allocated, less than n only when memory runs out
  */
-void mm_free(void *bp)
+int mm_malloc_batch(size_t size, int n, void **out)
 {
-    size_t size = GET_BLK_SIZE(bp);
+    size_t asize;
+    char *bp;
+    arena_t *a;
+    int i = 0, k;
 
-    PUT(HDRP(bp), PACK(size, 0));
-    PUT(FTRP(bp), PACK(size, 0));
-    
-    add_seglist(bp, size);
-    coalesce(bp);
+    if (size <= 0 || n <= 0)
+        return 0;
+    if (size >= MMAP_MIN) {
+        while (i < n && (out[i] = map_alloc(size)) != NULL)
+            i++;
+        return i;
+    }
+
+    if (size <= SLAB_MAX)
+        asize = (SLAB_CLASS(size) + 1) * SLAB_STEP;
+    else
+        asize = MAX(ALIGN(size + WSIZE), MIN_BLOCK);
+
+    if ((a = get_home()) == NULL)
+        return 0;
+
+    /* Reuse blocks this thread freed recently */
+    while (asize <= TC_MAX_SIZE && i < n && (bp = tc_head[asize / ALIGNMENT]) != NULL) {
+        tc_head[asize / ALIGNMENT] = *(void **)bp;
+        tc_count[asize / ALIGNMENT]--;
+        out[i++] = bp;
+    }
+    if (i == n)
+        return n;
+
+    arena_lock(a);
+    arena = a;
+
+    if (size <= SLAB_MAX) {
+        while (i < n && (out[i] = slab_alloc(asize)) != NULL)
+            i++;
+    } else {
+        while (i < n && (out[i] = quick_alloc(asize)) != NULL)
+            i++;
+        while (i < n) {
+            k = MIN(n - i, MAX_HEAP / asize);
+            if ((bp = find_fit(k * asize)) == NULL && (bp = find_fit(asize)) == NULL &&
+                a->quick_map != 0) {
+                quick_flush();
+                bp = find_fit(asize);
+            }
+            /* No fit found. Get more memory, for fewer blocks if need be */
+            while (bp == NULL && k > 0) {
+                if ((bp = extend_heap(MAX(k * asize, DCHUNKSIZE)/WSIZE)) == NULL)
+                    k /= 2;
+            }
+            if (bp == NULL)
+                break;
+            i += carve(bp, asize, n - i, out + i);
+        }
+    }
 
-    return;
+    arena_unlock(a);
+    return i;
 }
 
 /*
- * mm_realloc - Implemented simply in terms of mm_malloc and mm_free
+ * mm_memalign - allocate size bytes at a multiple of alignment. Larger
+ *     alignments than ALIGNMENT are served from the arena, never from
+ *     runs or mappings: a free block with room for the block and the
+ *     slack in front of it is split three ways, and the slack and the
+ *     rest go back on the free lists
  */
-void *mm_realloc(void *ptr, size_t size)
+void *mm_memalign(size_t alignment, size_t size)
 {
-    void *old_ptr = ptr;
-    void *new_ptr = NULL;
-    int realloced = 0;
+    size_t asize, need;
+    char *bp;
+    arena_t *a;
 
-    /* initial allocation */
-    if (ptr == NULL)
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+        return NULL;
+    if (alignment <= ALIGNMENT)
         return mm_malloc(size);
+    if (size <= 0 || size > MAX_HEAP || alignment > MAX_HEAP)
+        return NULL;
 
-    /* if new size is zero, free */
-    if (size == 0) {
-        mm_free(ptr);
-        return ptr;
-    }
-    
-    size_t csize = GET_BLK_SIZE(ptr) - DSIZE;   /* Block size without header and footer */
-    size_t asize = ALIGN(size);                 /* Adjusted block size */
+    /* the slack is a free block of its own, so at least MIN_BLOCK */
+    asize = MAX(ALIGN(size + WSIZE), MIN_BLOCK);
+    need = asize + alignment + MIN_BLOCK;
 
-    /* realloc size == old size */
-    if (asize == csize)
-        return old_ptr;
+    if ((a = get_home()) == NULL)
+        return NULL;
+    arena_lock(a);
+    arena = a;
 
-    size_t padding = 0;
-    /* realloc size < old size */
-    if (asize < csize) {
-        padding = csize - asize;
-        if (padding <= DSIZE) {
-            return old_ptr;
-        }
-        PUT(HDRP(old_ptr), PACK(asize + DSIZE, 1));
-        PUT(FTRP(old_ptr), PACK(asize + DSIZE, 1));
-        new_ptr = old_ptr;
-        realloced = 1;
+    if ((bp = find_fit(need)) == NULL && a->quick_map != 0) {
+        quick_flush();
+        bp = find_fit(need);
     }
-    /* realloc size > old size */
-    else if (asize > csize) {
-        void *next_ptr = NULL;
-        void *prev_ptr = NULL;
-        
-        next_ptr = NEXT_BLKP(old_ptr);
-        prev_ptr = PREV_BLKP(old_ptr);
-        size_t nsize, psize;
-        size_t new_size = 0;
-        
-        nsize = (next_ptr) ? GET_BLK_SIZE(next_ptr) : 0;
-        psize = (prev_ptr) ? GET_BLK_SIZE(prev_ptr) : 0;
-
-        int previous_merge = prev_ptr != NULL && !GET_ALLOC(HDRP(prev_ptr));
-        int next_merge = next_ptr != NULL && !GET_ALLOC(HDRP(next_ptr));        
-
-        if (previous_merge) {
-            if (psize + csize >= asize) {
-                padding = csize + psize - asize;
-                remove_seglist(prev_ptr);
-                new_size = (padding > DSIZE) ? asize + DSIZE : csize + psize + DSIZE;
-                new_ptr = prev_ptr;
-                PUT(HDRP(new_ptr), PACK(new_size, 1));
-                memmove(new_ptr, old_ptr, csize + DSIZE);
-                PUT(FTRP(new_ptr), PACK(new_size, 1));
-                realloced = 1;
-            }
-        } else if (next_merge) {
-            if (nsize + csize >= asize) {
-                padding = csize + nsize - asize;
-                remove_seglist(next_ptr);
-                new_size = (padding > DSIZE) ? asize + DSIZE : csize + nsize + DSIZE;
-                PUT(HDRP(old_ptr), PACK(new_size, 1));
-                PUT(FTRP(old_ptr), PACK(new_size, 1));
-                new_ptr = old_ptr;
-                realloced = 1;
-            }
-        }
+    if (bp == NULL)
+        bp = extend_heap(MAX(need, DCHUNKSIZE)/WSIZE);
+    if (bp != NULL)
+        bp = place_aligned(bp, asize, alignment);
 
-        int previous_next_merge = !GET_ALLOC(HDRP(prev_ptr)) && !GET_ALLOC(HDRP(next_ptr));
-
-        if (previous_next_merge) {
-            if (psize + nsize + csize >= asize) {
-                padding = csize + psize + nsize - asize;
-                remove_seglist(next_ptr);
-                remove_seglist(prev_ptr);
-                new_size = (padding > DSIZE) ? asize + DSIZE : csize + psize + nsize + DSIZE;
-                new_ptr = prev_ptr;
-                PUT(HDRP(new_ptr), PACK(new_size, 1));
-                memmove(new_ptr, old_ptr, csize+DSIZE);
-                PUT(FTRP(new_ptr), PACK(new_size, 1));
-                realloced = 1;
-            }
-        }
+    arena_unlock(a);
+    return bp;
+}
+
+/*
+ * mm_calloc - allocate nmemb * size zeroed bytes. Mappings come zeroed,
+ *     and so does the heap past memlib's dirty mark: when the block
+ *     reaches past it, only the part below the mark and the words
+ *     extend_heap wrote above it, the first free block's links and
+ *     footer, are cleared
+ */
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    size_t asize, total;
+    char *bp, *dirty;
+    arena_t *a;
+
+    if (nmemb != 0 && size > SIZE_MAX / nmemb)
+        return NULL;
+    total = nmemb * size;
+    if (total >= MMAP_MIN)
+        return map_alloc(total);
+
+    /* small blocks are likely cached and dirty anyway */
+    asize = MAX(ALIGN(total + WSIZE), MIN_BLOCK);
+    if (asize <= QUICK_MAX) {
+        if ((bp = mm_malloc(total)) != NULL)
+            memset(bp, 0, total);
+        return bp;
     }
 
-    if (realloced) {
-        void * ret = NULL;
-        if (padding > DSIZE) {
-            ret = NEXT_BLKP(new_ptr);
-            PUT(HDRP(ret), PACK(padding, 0));
-            PUT(FTRP(ret), PACK(padding, 0));
-            add_seglist(ret, GET_BLK_SIZE(ret));
-            coalesce(ret);
-        }
+    if ((a = get_home()) == NULL)
+        return NULL;
+    arena_lock(a);
+    arena = a;
+    dirty = mem_region_dirty(a->region);
+    bp = block_alloc(asize);
+    arena_unlock(a);
+    if (bp == NULL)
+        return NULL;
+
+    if (bp + total <= dirty) {
+        memset(bp, 0, total);
     } else {
-        new_ptr = mm_malloc(size);
-        if (new_ptr == NULL)
-            return NULL;
-        memcpy(new_ptr, old_ptr, csize + DSIZE);
-        mm_free(old_ptr);
+        memset(bp, 0, MAX(dirty - bp, 2*WSIZE));
+        PUT(FTRP(bp), 0);
     }
-    
-    return new_ptr;
+    return bp;
 }
 
 /*
- * extend_heap - extend heap memory and manage new free block
- * referenced the textbook
+ * mm_free - keep small blocks of this thread's arena in the thread
+ *     cache, give the rest back to the arena that owns them
  */
-static void *extend_heap(size_t words)
+void mm_free(void *bp)
 {
-    char *bp;
+    arena_t *a;
+    int slab;
     size_t size;
-    
-    /* Allocate an even number of words to maintain alignment */
-    size = (words % 2) ? (words + 1)*WSIZE : words * WSIZE;
-    if ((long)(bp = mem_sbrk(size)) == -1)
-        return NULL;
-    
-    /* Initialize free block header/footer and the epilogue header */
-    PUT(HDRP(bp), PACK(size, 0));           /* Free block header */
-    PUT(FTRP(bp), PACK(size, 0));           /* Free block footer */
-    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));   /* New epilogue header */
-    
-    /* insert free block to segregated list */
-    add_seglist(bp, size);
 
-    /* Coalesce if the previous block was free */
-    return coalesce(bp);
-}
+    if (MAPPED(bp)) {
+        mem_unmap((char *)bp - ALIGNMENT);
+        return;
+    }
 
+    a = ARENA_OF(bp);
+    slab = IS_RUN(a, bp);
+    size = slab ? RUN_OF(bp)->size : GET_BLK_SIZE(bp);
+
+    /* the cache bins up to SLAB_MAX hold slab objects only, so blocks
+       that realloc shrank that far go straight back to the arena */
+    if ((slab || size > SLAB_MAX) && tc_put(a, bp, size))
+        return;
+    arena_free(a, bp, size);
+}
 
 /*
- * coalesce - merge adjacent free blocks
- * referenced the textbook
+ * mm_free_sized - mm_free, taking the block size from the caller's
+ *     size instead of the block: a block is at least as large as the
+ *     size last asked for, so it can go in the thread cache bin of that
+ *     size without its header being read, and a slab object's size is
+ *     its class's, which slab_free uses instead of the run's. A block
+ *     going back to its arena still has its header read, since
+ *     coalescing needs its exact size and the bits in the same word.
+ *     Built with -DCHECK, the size is checked against the block
  */
-static void *coalesce(void *bp)
+void mm_free_sized(void *bp, size_t size)
 {
-    size_t prev_alloc = GET_ALLOC(HDRP(PREV_BLKP(bp)));
-    size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
-    size_t size = GET_SIZE(HDRP(bp));
-
-    /* Case 1 */
-    if (prev_alloc && next_alloc) {
-        return bp;
-    }
-    
-    /* remove current free block from segregated list */
-    remove_seglist(bp);
+    arena_t *a;
+    int slab;
 
-    /* Case 2 */
-    if (prev_alloc && !next_alloc) {
-        size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
-        remove_seglist(NEXT_BLKP(bp));
-        PUT(HDRP(bp), PACK(size, 0));
-        PUT(FTRP(bp), PACK(size, 0));
+    if (MAPPED(bp)) {
+        mem_unmap((char *)bp - ALIGNMENT);
+        return;
     }
-    /* Case 3 */
-    else if (!prev_alloc && next_alloc) {
-        remove_seglist(PREV_BLKP(bp));
-        size += GET_SIZE(HDRP(PREV_BLKP(bp)));
-        PUT(FTRP(bp), PACK(size, 0));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
-        bp = PREV_BLKP(bp);
+    if (size == 0) {
+        mm_free(bp);
+        return;
     }
-    /* Case 4 */
-    else {
-        size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(FTRP(NEXT_BLKP(bp)));
-        remove_seglist(PREV_BLKP(bp));
-        remove_seglist(NEXT_BLKP(bp));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
-        PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
-        bp = PREV_BLKP(bp);
+
+    a = ARENA_OF(bp);
+    slab = IS_RUN(a, bp);
+    if (slab)
+        size = (SLAB_CLASS(MIN(size, SLAB_MAX)) + 1) * SLAB_STEP;
+    else
+        size = MAX(ALIGN(size + WSIZE), MIN_BLOCK);
+    if (CHECK != 0 && (slab ? size != RUN_OF(bp)->size : size > GET_BLK_SIZE(bp))) {
+        printf("SIZED FREE OF %p GIVES %zu BYTES, BLOCK HAS %zu\n", bp, size,
+               slab ? (size_t)RUN_OF(bp)->size : (size_t)GET_BLK_SIZE(bp));
+        fflush(stdout);
+        abort();
     }
 
-    /* add merged free block to segregated list */
-    add_seglist(bp, size);
-    return bp;
+    if ((slab || size > SLAB_MAX) && tc_put(a, bp, size))
+        return;
+    arena_free(a, bp, size);
 }
 
 /*
- * find_fit - implement best-fit strategy
+ * tc_put - push block bp of size bytes, still marked allocated, on
+ *     this thread's cache; returns 0 if there is no cache yet, the
+ *     size's bin is full, or the block belongs to arena a other than
+ *     this thread's, which is where it goes back right away
  */
-static void *find_fit(size_t asize, size_t csize, int index)
+static int tc_put(arena_t *a, void *bp, size_t size)
 {
-   
-    void *seg_ptr = NULL;
+    if (get_home() != a || next_thread <= 1 || size > TC_MAX_SIZE ||
+        tc_count[size / ALIGNMENT] >= TC_COUNT)
+        return 0;
+    if (tc_count[size / ALIGNMENT]++ == 0)
+        pthread_setspecific(tcache_key, (void *)1);
+    *(void **)bp = tc_head[size / ALIGNMENT];
+    tc_head[size / ALIGNMENT] = bp;
+    return 1;
+}
 
-    if (index > SEG_SIZE)
-        return seg_ptr;
+/*
+ * mm_free_batch - free n blocks at once, bypassing the thread cache.
+ *     ptrs is sorted by address, so each arena is locked once and
+ *     blocks of the batch that lie next to each other become one block
+ *     before they are freed, coalescing only where the run ends
+ */
+void mm_free_batch(void **ptrs, int n)
+{
+    arena_t *a;
+    char *bp;
+    size_t size;
+    int i = 0, j;
 
-    seg_ptr = GET_SEG_LIST_PTR(seg_list_ptr, index);
-    
-    /* search best fit */
-    if (csize <= 1 && seg_ptr != NULL) {
-        while (seg_ptr != NULL && (asize > GET_BLK_SIZE(seg_ptr)))
-            seg_ptr = SEG_PREV_BLKP(seg_ptr);
-        if (seg_ptr != NULL)
-            return seg_ptr;
+    qsort(ptrs, n, sizeof(void *), by_address);
+    while (i < n && ptrs[i] == NULL)
+        i++;
+    while (i < n) {
+        if (MAPPED(ptrs[i])) {
+            mem_unmap((char *)ptrs[i++] - ALIGNMENT);
+            continue;
+        }
+        a = ARENA_OF(ptrs[i]);
+        arena_lock(a);
+        arena = a;
+        for (; i < n && !MAPPED(ptrs[i]) && ARENA_OF(ptrs[i]) == a; i = j) {
+            bp = ptrs[i];
+            j = i + 1;
+            if (IS_RUN(a, bp)) {
+                slab_free(RUN_OF(bp), bp, RUN_OF(bp)->size);
+                continue;
+            }
+            size = GET_BLK_SIZE(bp);
+            while (j < n && ptrs[j] == bp + size && !IS_RUN(a, ptrs[j]))
+                size += GET_BLK_SIZE(ptrs[j++]);
+            if (j > i + 1) {
+                PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)) | 1));
+                check_merged(bp);
+            }
+            free_block(bp);
+        }
+        arena_unlock(a);
     }
-    csize >>= 1;
+}
+
+static int by_address(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t)*(void **)a, y = (uintptr_t)*(void **)b;
 
-    /* if not found */
-    return find_fit(asize, csize, index + 1);
+    return x < y ? -1 : x > y;
 }
 
 /*
- * place - returns a pointer at best-fit position
+ * arena_free - return a block or slab object to arena a; size is the
+ *     object's size if it is a slab object, and unused otherwise
  */
-static void *place(void *bp, size_t asize)
+static void arena_free(arena_t *a, void *bp, size_t size)
 {
-    size_t csize = GET_BLK_SIZE(bp);
-    size_t padding = csize - asize;
-    void *nbp = NULL;
-    remove_seglist(bp);
-    
-    /* if the remaining is not enough */
-    if (padding < 2 * DSIZE) {
-        PUT(HDRP(bp), PACK(csize, 1));
-        PUT(FTRP(bp), PACK(csize, 1));
-        return bp;
-    } else if (asize > MINSIZE) {
-        PUT(HDRP(bp), PACK(asize, 1));
-        PUT(FTRP(bp), PACK(asize, 1));
-        nbp = NEXT_BLKP(bp);
-        PUT(HDRP(nbp), PACK(padding, 0));
-        PUT(FTRP(nbp), PACK(padding, 0));
-        add_seglist(nbp, padding);
-        return bp;
-    } else {
-        PUT(HDRP(bp), PACK(padding, 0));
-        PUT(FTRP(bp), PACK(padding, 0));
-        nbp = NEXT_BLKP(bp);
-        PUT(HDRP(nbp), PACK(asize, 1));
-        PUT(FTRP(nbp), PACK(asize, 1));
-        add_seglist(bp, padding);
-        return nbp;
+    arena_lock(a);
+    arena = a;
+    if (IS_RUN(a, bp))
+        slab_free(RUN_OF(bp), bp, size);
+    else
+        free_block(bp);
+    arena_unlock(a);
+}
+
+/*
+ * arena_lock - lock arena a; if another thread holds it, count the
+ *     wait and the time it takes
+ */
+static void arena_lock(arena_t *a)
+{
+    struct timespec start, end;
+
+    if (pthread_mutex_trylock(&a->lock) != 0) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pthread_mutex_lock(&a->lock);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        __sync_fetch_and_add(&lock_waits, 1);
+        __sync_fetch_and_add(&lock_wait_ns, (end.tv_sec - start.tv_sec) * 1000000000L +
+                                            (end.tv_nsec - start.tv_nsec));
     }
+    a->limits.requests++;
 }
 
 /*
- * init_seglist - initialize segregated lists
+ * arena_unlock - unlock arena a, checking it first when built with
+ *     -DCHECK: n > 0 checks the next n blocks, -1 the whole arena.
+ *     The first inconsistency aborts, right after the request that
+ *     caused it.
  */
-static void init_seglist(void) 
+static void arena_unlock(arena_t *a)
 {
-    /* make space for the segregated lists */
-    seg_list_ptr = mem_sbrk(SEG_SIZE * WSIZE);
-    
-    /* initialize the segregated lists */
-    for (int i = 0; i < SEG_SIZE; i++) {
-        SET_SEG_LIST_PTR(seg_list_ptr, i, NULL);
+    if (CHECK != 0 && (CHECK < 0 ? mm_check() : mm_check_slice(CHECK)) != 0) {
+        fflush(stdout);
+        abort();
     }
+    pthread_mutex_unlock(&a->lock);
 }
 
 /*
- * add_seglist - add new free block to segregated list
+ * mm_lock_stats - arena lock waits since mm_init, and the seconds spent
  */
-static void add_seglist(void *bp, size_t blk_size)
+void mm_lock_stats(unsigned long *waits, double *secs)
+{
+    *waits = lock_waits;
+    *secs = lock_wait_ns / 1e9;
+}
+
+/*
+ * mm_heap_walk - walk the blocks of every arena in turn; the cursor is
+ *     the block last reported. A slab run is one allocated block, and
+ *     blocks on quick lists are cached. Blocks in thread caches look
+ *     allocated, and mapped blocks are not part of any arena. Takes no
+ *     locks, so no other thread may use the package meanwhile.
+ */
+void *mm_heap_walk(void *cursor, mm_block_t *block)
 {
-    void *curr = NULL;
-    void *prev = NULL;
-    int index;
-  
-    /* find the offset of segregated list */
-    for (index = 0; index < SEG_SIZE - 1; index++) {
-        if (blk_size <= 1)
-            break;
-        blk_size >>= 1;
+    char *bp = NULL;
+    int region = -1;
+
+    if (cursor != NULL) {
+        bp = NEXT_BLKP(cursor);
+        region = mem_region_of(cursor);
     }
-    
-    /* the blk_size's class address of segregated list */
-    curr = GET_SEG_LIST_PTR(seg_list_ptr, index);
-    
-    while (curr != NULL && blk_size > GET_BLK_SIZE(curr)) {
-        prev = curr;
-        curr = SEG_PREV_BLKP(curr);
+    /* past an arena's epilogue, start on the next arena in use */
+    while (bp == NULL || GET_SIZE(HDRP(bp)) == 0) {
+        if (++region >= mem_regions())
+            return NULL;
+        bp = mem_region_size(region) == 0 ? NULL :
+            NEXT_BLKP(((arena_t *)mem_region_lo(region))->prologue);
     }
-    
-    if (curr && prev) {
-        PUT(GET_SEG_PREV_ADR(prev), UNSIGN(bp));
-        PUT(GET_SEG_NEXT_ADR(bp), UNSIGN(prev));
-        PUT(GET_SEG_PREV_ADR(bp),UNSIGN(curr));
-        PUT(GET_SEG_NEXT_ADR(curr), UNSIGN(bp));
-    } else if (curr && !prev) {
-        PUT(GET_SEG_NEXT_ADR(curr), UNSIGN(bp));
-        PUT(GET_SEG_PREV_ADR(bp), UNSIGN(curr));
-        PUT(GET_SEG_NEXT_ADR(bp), UNSIGN(NULL));
-        SET_SEG_LIST_PTR(seg_list_ptr, index, bp);
-    } else if (!curr && prev) {
-        PUT(GET_SEG_NEXT_ADR(bp), UNSIGN(prev));
-        PUT(GET_SEG_PREV_ADR(prev), UNSIGN(bp));
-        PUT(GET_SEG_PREV_ADR(bp), UNSIGN(NULL));
-    } else {
-        PUT(GET_SEG_NEXT_ADR(bp), UNSIGN(NULL));
-        PUT(GET_SEG_PREV_ADR(bp), UNSIGN(NULL));
-        SET_SEG_LIST_PTR(seg_list_ptr, index, bp);
+    block->addr = HDRP(bp);
+    block->size = GET_BLK_SIZE(bp);
+    if (!GET_ALLOC(HDRP(bp)))
+        block->state = MM_BLOCK_FREE;
+    else if (GET(HDRP(bp)) & QUICK)
+        block->state = MM_BLOCK_CACHED;
+    else
+        block->state = MM_BLOCK_ALLOC;
+    return bp;
+}
+
+/*
+ * free_block - Freeing a small block puts it on its quick list. Others
+ *  1) coalesce with free neighbours
+ *  2) insert into the segregated list
+ * referenced the textbook
+ */
+static void free_block(void *bp)
+{
+    size_t size = GET_BLK_SIZE(bp);
+
+    if (size > SLAB_MAX && size <= QUICK_MAX) {
+        PUT(HDRP(bp), GET(HDRP(bp)) | QUICK);
+        PUT(bp, arena->quick[QUICK_BIN(size)]);
+        arena->quick[QUICK_BIN(size)] = UNSIGN(bp);
+        arena->quick_map |= 1U << QUICK_BIN(size);
+        if (++arena->quick_count >= QUICK_LIMIT)
+            quick_flush();
+        return;
     }
+
+    write_block(bp, size, GET_PREV_ALLOC(HDRP(bp)), 0);
+    bp = coalesce(bp);
+    if (GET_BLK_SIZE(bp) >= MIN(TRIM_MAX, DISCARD_MIN))
+        release(bp);
 }
-    
+
 /*
- * remove_seglist - remove new allocated block from segregated list
+ * release - return the memory of free block bp to the system. A top
+ *     block of trim_max bytes or more shrinks the heap to a page boundary
+ *     TRIM_PAD bytes in. Any other block of discard_min bytes or more
+ *     keeps its header, links and footer and has the pages between
+ *     discarded. Both limits start at TRIM_MAX and DISCARD_MIN; extend_heap
+ *     raises them when what was given back is soon needed again, and
+ *     lowers them again when a block they held back was not
  */
-static void remove_seglist(void *bp)
+static void release(void *bp)
 {
-    void *prev = SEG_PREV_BLKP(bp);
-    void *next = SEG_NEXT_BLKP(bp);
     size_t size = GET_BLK_SIZE(bp);
-    void *list_ptr = NULL;
-    
-    int index;
-    /* find the offset of segregated list */
-    for (index = 0; index < SEG_SIZE - 1; index++) {
-       if (size <= 1)
-          break;
-        
-       size >>= 1;
+    int at_top = GET_SIZE(HDRP(NEXT_BLKP(bp))) == 0;
+    size_t page;
+    char *brk, *top;
+
+    if (size < (at_top ? LIMITS->trim_max : LIMITS->discard_min)) {
+        if (size >= (at_top ? TRIM_MAX : DISCARD_MIN)) {
+            LIMITS->kept = MAX(LIMITS->kept, size);
+            LIMITS->requests = 0;
+        }
+        return;
     }
-    
-    /* removing the block depends on the next and prev */
-    if (next == NULL) {
-        SET_SEG_LIST_PTR(seg_list_ptr, index, prev);
-        list_ptr = GET_SEG_LIST_PTR(seg_list_ptr, index);
-        if (list_ptr != NULL)
-            PUT(GET_SEG_NEXT_ADR(list_ptr), UNSIGN(NULL));
+    if (at_top) {
+        page = mem_pagesize();
+        brk = (char *)bp + size;
+        top = (char *)(((uintptr_t)bp + TRIM_PAD + page - 1) & ~(uintptr_t)(page - 1));
+        remove_seglist(bp);
+        mem_region_sbrk(arena->region, -(int)(brk - top));
+        size -= brk - top;
+        PUT(top - WSIZE, PACK(0, 1));                           /* New epilogue header */
+        write_block(bp, size, GET_PREV_ALLOC(HDRP(bp)), 0);
+        add_seglist(bp, size);
+        LIMITS->trimmed = MIN(LIMITS->trimmed + (brk - top), MAX_HEAP);
     } else {
-        PUT(GET_SEG_PREV_ADR(next), UNSIGN(prev));
-        if (prev != NULL)
-            PUT(GET_SEG_NEXT_ADR(prev), UNSIGN(next));
+        mem_discard((char *)bp + 2*WSIZE, FTRP(bp) - ((char *)bp + 2*WSIZE));
+        PUT(HDRP(bp), GET(HDRP(bp)) | DISCARDED);
+        LIMITS->discarded = MIN(LIMITS->discarded + size, MAX_HEAP);
     }
+    LIMITS->requests = 0;
 }
 
 /*
- * mm_check - check segregated list and heap
+ * quick_flush - really free every block on the quick lists
  */
-static int mm_check(void) {
-    int errno = 0;
-
-    void *curr = NULL;
-    curr = heap_ptr;
+static void quick_flush(void)
+{
+    void *bp;
+    int i;
 
-    /* heap valid check */
-    while (curr != NULL && GET_SIZE(HDRP(curr)) != 0) {
-        /* header and footer consistency check */
-        if (GET_ALLOC(HDRP(curr)) != GET_ALLOC(FTRP(curr))) {
-            printf("BLOCK %p HEADER AND FOOTER HAS DIFFERENT ALLOCATION BIT\n", curr);
-            errno = -1;
-        }
-        if (GET_SIZE(HDRP(curr)) != GET_SIZE(FTRP(curr))) {
-            printf("BLOCK %p HEADER AND FOOTER HAS DIFFERENT SIZE\n", curr);
-            errno = -1;
-        }
-        /* block address check */
-        if (curr < mem_heap_lo() || curr > mem_heap_hi()) {
-            printf("BLOCK %p INVALID\n", curr);
+    while (arena->quick_map != 0) {
+        i = __builtin_ctz(arena->quick_map);
+        arena->quick_map &= arena->quick_map - 1;
+        while ((bp = ADDR(arena->quick[i])) != NULL) {
+            arena->quick[i] = GET(bp);
+            write_block(bp, GET_BLK_SIZE(bp), GET_PREV_ALLOC(HDRP(bp)), 0);
+            coalesce(bp);
         }
-        curr = NEXT_BLKP(curr);
     }
+    arena->quick_count = 0;
+}
 
-    void * blkp = NULL;
-    void * nblkp = NULL;
-    
-    /* segregated list valid check */
-    for (int i = 0; i < SEG_SIZE; i++) {
-        blkp = GET_SEG_LIST_PTR(seg_list_ptr, i);
+/*
+ * tcache_flush - thread exit: return the cached blocks to their arenas
+ */
+static void tcache_flush(void *unused)
+{
+    void *bp;
+    int i;
 
-        while (blkp != NULL) {
-            /* block address check */
-            if (blkp < mem_heap_lo() || blkp > mem_heap_hi()) {
-                printf("FREE BLOCK %p INVALID\n", blkp);
-                errno = -1;
-            }
-            /* allocated block is in free list check */
-            if (GET_ALLOC(blkp)) {
-                printf("FREE BLOCK %p MARKED ALLOC\n", blkp);
+    if (home_generation != generation)
+        return;
+    for (i = 0; i < TC_BINS; i++) {
+        while ((bp = tc_head[i]) != NULL) {
+            tc_head[i] = *(void **)bp;
+            arena_free(ARENA_OF(bp), bp, i * ALIGNMENT);
+        }
+        tc_count[i] = 0;
+    }
+}
+
+static void make_tcache_key(void)
+{
+    pthread_key_create(&tcache_key, tcache_flush);
+}
+
+/*
+ * mm_realloc - resize in place under the owning arena's lock, or fall
+ *     back to mm_malloc, copy and mm_free. A block grown again right
+ *     after its last growth is taken to keep growing: it moves with, or
+ *     extends the heap by, 1/2^GROW_SHIFT of its size to spare. Mapped
+ *     blocks that stay at least MMAP_MIN bytes are resized by mremap
+ */
+void *mm_realloc(void *ptr, size_t size)
+{
+    void *new_ptr;
+    arena_t *a;
+
+    /* initial allocation */
+    if (ptr == NULL)
+        return mm_malloc(size);
+
+    /* if new size is zero, free */
+    if (size == 0) {
+        mm_free(ptr);
+        return ptr;
+    }
+
+    size_t csize;                   /* Payload size of the old block */
+    int regrow = 0;
+
+    a = MAPPED(ptr) ? NULL : ARENA_OF(ptr);
+    if (a == NULL) {
+        if (size >= MMAP_MIN)
+            return map_resize(ptr, size);
+        csize = GET_BLK_SIZE(ptr) - ALIGNMENT;
+    } else if (IS_RUN(a, ptr)) {
+        /* a slab object keeps its place while the new size fits */
+        csize = RUN_OF(ptr)->size;
+        if (size <= csize)
+            return ptr;
+    } else if (size >= MMAP_MIN) {
+        /* moves to a mapping of its own */
+        csize = GET_BLK_SIZE(ptr) - WSIZE;
+    } else {
+        csize = GET_BLK_SIZE(ptr) - WSIZE;
+        arena_lock(a);
+        arena = a;
+        regrow = a->last_grown == UNSIGN(ptr);
+        new_ptr = realloc_in_place(ptr, size, regrow);
+        if (new_ptr != NULL && size > csize)
+            a->last_grown = UNSIGN(new_ptr);
+        arena_unlock(a);
+        if (new_ptr != NULL)
+            return new_ptr;
+    }
+
+    new_ptr = mm_malloc(regrow ? size + (size >> GROW_SHIFT) : size);
+    if (new_ptr == NULL)
+        return NULL;
+    memcpy(new_ptr, ptr, MIN(csize, size));
+    mm_free(ptr);
+
+    if (MAPPED(new_ptr))
+        return new_ptr;
+    a = ARENA_OF(new_ptr);
+    if (!IS_RUN(a, new_ptr)) {
+        arena_lock(a);
+        a->last_grown = UNSIGN(new_ptr);
+        arena_unlock(a);
+    }
+    return new_ptr;
+}
+
+/*
+ * map_alloc - map a block of size bytes and write its header
+ */
+static void *map_alloc(size_t size)
+{
+    size_t len = MAP_LEN(size);
+    char *p;
+
+    if (len < size || len > UINT_MAX - 7 || (p = mem_map(len)) == NULL)
+        return NULL;
+    PUT(p + ALIGNMENT - WSIZE, PACK(len, 1));
+    return p + ALIGNMENT;
+}
+
+/*
+ * map_resize - grow or shrink the mapping of block ptr to fit size bytes
+ */
+static void *map_resize(void *ptr, size_t size)
+{
+    size_t len = MAP_LEN(size);
+    char *p;
+
+    if (len == GET_BLK_SIZE(ptr))
+        return ptr;
+    if (len < size || len > UINT_MAX - 7 ||
+        (p = mem_remap((char *)ptr - ALIGNMENT, len)) == NULL)
+        return NULL;
+    PUT(p + ALIGNMENT - WSIZE, PACK(len, 1));
+    return p + ALIGNMENT;
+}
+
+/*
+ * realloc_in_place - shrink in place, or grow into the next block, the
+ *     heap tail, or the previous block (the only case that copies);
+ *     returns NULL if the block has to move. A block grown last time
+ *     keeps its spare room when asked for less and takes new spare room
+ *     when it grows
+ */
+static void *realloc_in_place(void *ptr, size_t size, int grown)
+{
+    void *old_ptr = ptr;
+    void *new_ptr = NULL;
+    
+    size_t csize = GET_BLK_SIZE(ptr) - WSIZE;   /* Block size without header */
+    size_t asize = MAX(ALIGN(size + WSIZE), MIN_BLOCK) - WSIZE; /* Adjusted payload size */
+
+    size_t want = grown ? asize + ALIGN((asize + WSIZE) >> GROW_SHIFT) : asize;
+
+    /* realloc size == old size */
+    if (asize == csize)
+        return old_ptr;
+
+    size_t padding = 0;
+    /* realloc size < old size */
+    if (asize < csize) {
+        padding = csize - asize;
+        if (padding < MIN_BLOCK || csize <= want) {
+            return old_ptr;
+        }
+        PUT(HDRP(old_ptr), PACK(asize + WSIZE, GET_PREV_ALLOC(HDRP(old_ptr)) | 1));
+        new_ptr = old_ptr;
+    }
+    /* realloc size > old size */
+    else {
+        /* coalesce quick blocks first, one may be in the way */
+        if (arena->quick_map != 0)
+            quick_flush();
+
+        void *next_ptr = NEXT_BLKP(old_ptr);
+        void *prev_ptr = GET_PREV_ALLOC(HDRP(old_ptr)) ? NULL : PREV_BLKP(old_ptr);
+        size_t psize = prev_ptr ? GET_BLK_SIZE(prev_ptr) : 0;
+        size_t total = 0;
+
+        int previous_merge = prev_ptr != NULL;
+        int next_merge = !GET_ALLOC(HDRP(next_ptr));
+        size_t nsize = next_merge ? GET_BLK_SIZE(next_ptr) : 0;
+        /* only the epilogue, or a free block and the epilogue, follow */
+        int tail = GET_SIZE(HDRP(next_merge ? NEXT_BLKP(next_ptr) : next_ptr)) == 0;
+
+        if (next_merge && nsize + csize >= asize) {
+            remove_seglist(next_ptr);
+            total = nsize + csize;
+            new_ptr = old_ptr;
+        } else if (tail) {
+            /* extend the heap by the shortfall, but by no less than a
+               free block, or its links would overwrite the epilogue */
+            if ((next_ptr = extend_heap(MAX(want - csize - nsize, MIN_BLOCK)/WSIZE)) == NULL)
+                return NULL;
+            remove_seglist(next_ptr);
+            total = GET_BLK_SIZE(next_ptr) + csize;
+            new_ptr = old_ptr;
+        } else if (previous_merge && psize + csize >= asize) {
+            remove_seglist(prev_ptr);
+            total = psize + csize;
+            new_ptr = prev_ptr;
+        } else if (previous_merge && next_merge && psize + nsize + csize >= asize) {
+            remove_seglist(next_ptr);
+            remove_seglist(prev_ptr);
+            total = psize + nsize + csize;
+            new_ptr = prev_ptr;
+        } else {
+            return NULL;
+        }
+
+        padding = total - MIN(total, want);
+        if (padding < MIN_BLOCK)
+            padding = 0;
+        if (new_ptr != old_ptr)
+            memmove(new_ptr, old_ptr, csize);
+        PUT(HDRP(new_ptr), PACK(total - padding + WSIZE, GET_PREV_ALLOC(HDRP(new_ptr)) | 1));
+        set_prev_alloc(NEXT_BLKP(new_ptr), 1);
+        check_merged(new_ptr);
+    }
+
+    if (padding >= MIN_BLOCK) {
+        void *ret = NEXT_BLKP(new_ptr);
+        write_block(ret, padding, PREV_ALLOC, 0);
+        /* after a move into the previous block, ret spans the old one */
+        check_merged(coalesce(ret));
+    }
+    return new_ptr;
+}
+
+/*
+ * slab_alloc - hand out an object of class size from the first run of
+ *     the class with a free slot, starting a new run if there is none
+ */
+static void *slab_alloc(size_t size)
+{
+    run_t *run = ADDR(arena->run_list[SLAB_CLASS(size)]);
+    unsigned int map;
+    int w, i;
+
+    if (run == NULL && (run = new_run(size)) == NULL)
+        return NULL;
+
+    for (w = 0; (map = ~run->map[w]) == 0; w++)
+        ;
+    i = __builtin_ctz(map);
+    run->map[w] |= 1U << i;
+    if (++run->used == run->count)
+        remove_run(run);
+    return (char *)run + RUN_HDR + (w * 32 + i) * size;
+}
+
+/*
+ * slab_free - clear the bit of the object of size bytes; a run that was
+ *     full goes back on its class list, an empty one back to the heap
+ *     unless it is the only run left of its class
+ */
+static void slab_free(run_t *run, void *bp, size_t size)
+{
+    int i = ((char *)bp - (char *)run - RUN_HDR) / size;
+    size_t page;
+
+    run->map[i / 32] &= ~(1U << (i % 32));
+    if (run->used-- == run->count)
+        add_run(run);
+    if (run->used == 0 && (run->prev != 0 || run->next != 0)) {
+        remove_run(run);
+        page = PAGE_INDEX(arena, run);
+        RUN_MAP(arena)[page / 8] &= ~(1 << (page % 8));
+        free_block(run);
+    }
+}
+
+/*
+ * new_run - start a run of objects of the given size in a free block
+ *     that holds a page-aligned run wherever it starts, or at the end
+ *     of the heap grown up to the next page boundary; the arena's first
+ *     run also allocates the page bitmap
+ */
+static run_t *new_run(size_t size)
+{
+    size_t need = MAX(ALIGN(RUN_MAP_SIZE + WSIZE), MIN_BLOCK);
+    size_t page;
+    char *bp, *brk;
+    run_t *run;
+    int i;
+
+    if (arena->run_map == 0) {
+        if ((bp = find_fit(need)) == NULL &&
+            (bp = extend_heap(MAX(need, DCHUNKSIZE)/WSIZE)) == NULL)
+            return NULL;
+        bp = place(bp, need);
+        memset(bp, 0, RUN_MAP_SIZE);
+        arena->run_map = UNSIGN(bp);
+    }
+
+    /* a page given back by an empty run fits exactly, any block of
+       2*RUN_SIZE + MIN_BLOCK bytes holds a run with room in front */
+    if ((bp = find_fit(RUN_SIZE)) == NULL || (run = carve_run(bp)) == NULL) {
+        if ((bp = find_fit(2*RUN_SIZE + MIN_BLOCK)) == NULL) {
+            brk = (char *)mem_region_lo(arena->region) + mem_region_size(arena->region);
+            if ((bp = extend_heap(((char *)RUN_OF(brk + 2*RUN_SIZE - 1) - brk)/WSIZE)) == NULL)
+                return NULL;
+        }
+        /* one more page if the gap in front of the run is too small for a block */
+        while ((run = carve_run(bp)) == NULL)
+            if ((bp = extend_heap(RUN_SIZE/WSIZE)) == NULL)
+                return NULL;
+    }
+
+    /* the last word of the page is the next block's header */
+    run->size = size;
+    run->count = (RUN_SIZE - RUN_HDR - WSIZE) / size;
+    run->used = 0;
+    memset(run->map, 0, sizeof(run->map));
+    for (i = run->count; i < RUN_MAP_WORDS * 32; i++)
+        run->map[i / 32] |= 1U << (i % 32);
+    page = PAGE_INDEX(arena, run);
+    RUN_MAP(arena)[page / 8] |= 1 << (page % 8);
+    add_run(run);
+    return run;
+}
+
+/*
+ * carve_run - allocate a whole page of free block bp as a run block
+ *     and give the rest back to the lists: the last page, like place()
+ *     puts small blocks at the end, but the first one of the top block,
+ *     which leaves the top to the blocks realloc moves there to grow;
+ *     NULL if that would leave a gap in front smaller than a block
+ */
+static run_t *carve_run(void *bp)
+{
+    size_t csize = GET_BLK_SIZE(bp);
+    unsigned int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    size_t lead, trail;
+    run_t *run;
+
+    if (csize < RUN_SIZE)
+        return NULL;
+    if (GET_SIZE(HDRP(NEXT_BLKP(bp))) != 0)
+        run = RUN_OF((char *)bp + csize - RUN_SIZE);
+    else {
+        run = RUN_OF((char *)bp + RUN_SIZE - 1);
+        if (run != bp && (char *)run < (char *)bp + MIN_BLOCK)
+            run = (run_t *)((char *)run + RUN_SIZE);
+    }
+    lead = (char *)run - (char *)bp;
+    if ((char *)run < (char *)bp || (lead != 0 && lead < MIN_BLOCK) ||
+        lead + RUN_SIZE > csize)
+        return NULL;
+    trail = csize - lead - RUN_SIZE;
+    if (trail < MIN_BLOCK)
+        trail = 0;
+
+    remove_seglist(bp);
+    if (lead != 0) {
+        write_block(bp, lead, prev_alloc, 0);
+        add_seglist(bp, lead);
+        prev_alloc = 0;
+    }
+    write_block(run, csize - lead - trail, prev_alloc, 1);
+    if (trail != 0) {
+        bp = NEXT_BLKP(run);
+        write_block(bp, trail, PREV_ALLOC, 0);
+        add_seglist(bp, trail);
+    }
+    return run;
+}
+
+/*
+ * add_run - push a run on the list of its class
+ */
+static void add_run(run_t *run)
+{
+    unsigned int *head = &arena->run_list[SLAB_CLASS(run->size)];
+
+    run->prev = 0;
+    run->next = *head;
+    if (*head != 0)
+        ((run_t *)ADDR(*head))->prev = UNSIGN(run);
+    *head = UNSIGN(run);
+}
+
+/*
+ * remove_run - unlink a run from the list of its class
+ */
+static void remove_run(run_t *run)
+{
+    if (run->next != 0)
+        ((run_t *)ADDR(run->next))->prev = run->prev;
+    if (run->prev != 0)
+        ((run_t *)ADDR(run->prev))->next = run->next;
+    else
+        arena->run_list[SLAB_CLASS(run->size)] = run->next;
+}
+
+/*
+ * extend_heap - extend heap memory and manage new free block
+ * referenced the textbook
+ */
+static void *extend_heap(size_t words)
+{
+    char *bp;
+    size_t size, given;
+    
+    /* Allocate a multiple of ALIGNMENT to maintain alignment */
+    size = ALIGN(words * WSIZE);
+    if ((long)(bp = mem_region_sbrk(arena->region, size)) == -1)
+        return NULL;
+
+    /* Growing back within RELEASE_WAIT requests per page given back:
+       from now on give back only twice as much at once. Growing only
+       long after a block was held back: give back as at first */
+    given = LIMITS->trimmed + LIMITS->discarded;
+    if (given != 0 && LIMITS->requests < given / mem_pagesize() * RELEASE_WAIT) {
+        if (LIMITS->trimmed)
+            LIMITS->trim_max = MIN(2 * LIMITS->trimmed, MAX_HEAP);
+        if (LIMITS->discarded)
+            LIMITS->discard_min = MIN(2 * LIMITS->discarded, MAX_HEAP);
+    } else if (LIMITS->kept != 0 &&
+               LIMITS->requests >= LIMITS->kept / mem_pagesize() * RELEASE_WAIT) {
+        LIMITS->trim_max = TRIM_MAX;
+        LIMITS->discard_min = DISCARD_MIN;
+    }
+    LIMITS->trimmed = LIMITS->discarded = LIMITS->kept = 0;
+    
+    /* Initialize free block header/footer and the epilogue header */
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));    /* Free block header */
+    PUT(FTRP(bp), PACK(size, 0));                           /* Free block footer */
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));                   /* New epilogue header */
+    
+    /* Coalesce if the previous block was free, and index the result */
+    return coalesce(bp);
+}
+
+
+/*
+ * coalesce - merge a new free block with its free neighbours and add
+ *     the result to the segregated list
+ * referenced the textbook
+ */
+static void *coalesce(void *bp)
+{
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
+    size_t size = GET_SIZE(HDRP(bp));
+    unsigned int discarded = GET(HDRP(bp)) & DISCARDED;
+
+    /* Case 1 */
+    if (prev_alloc && next_alloc) {
+        add_seglist(bp, size);
+        return bp;
+    }
+
+    /* Case 2 */
+    if (prev_alloc && !next_alloc) {
+        size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
+        discarded |= GET(HDRP(NEXT_BLKP(bp))) & DISCARDED;
+        remove_seglist(NEXT_BLKP(bp));
+        PUT(HDRP(bp), PACK(size, prev_alloc | discarded));
+        PUT(FTRP(bp), PACK(size, 0));
+    }
+    /* Case 3 */
+    else if (!prev_alloc && next_alloc) {
+        remove_seglist(PREV_BLKP(bp));
+        size += GET_SIZE(HDRP(PREV_BLKP(bp)));
+        bp = PREV_BLKP(bp);
+        discarded |= GET(HDRP(bp)) & DISCARDED;
+        PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)) | discarded));
+        PUT(FTRP(bp), PACK(size, 0));
+    }
+    /* Case 4 */
+    else {
+        size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(HDRP(NEXT_BLKP(bp)));
+        discarded |= GET(HDRP(NEXT_BLKP(bp))) & DISCARDED;
+        remove_seglist(PREV_BLKP(bp));
+        remove_seglist(NEXT_BLKP(bp));
+        bp = PREV_BLKP(bp);
+        discarded |= GET(HDRP(bp)) & DISCARDED;
+        PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)) | discarded));
+        PUT(FTRP(bp), PACK(size, 0));
+    }
+
+    /* add merged free block to segregated list */
+    add_seglist(bp, size);
+    check_merged(bp);
+    return bp;
+}
+
+/*
+ * find_fit - best fit among the first FIT_SCAN blocks of the request's
+ *     own class, otherwise the head of the next non-empty larger class,
+ *     whose blocks all fit, otherwise the smallest large block
+ */
+static void *find_fit(size_t asize)
+{
+    void *seg_ptr, *best = NULL;
+    unsigned int map;
+    int fl, sl, n;
+
+    if (asize >= TREE_MIN)
+        return tree_fit(asize);
+    mapping(asize, &fl, &sl);
+
+    seg_ptr = GET_SEG_LIST_PTR(seg_list_ptr, SEG_INDEX(fl, sl));
+    for (n = 0; seg_ptr != NULL && n < FIT_SCAN; n++) {
+        size_t size = GET_BLK_SIZE(seg_ptr);
+        if (size >= asize && (best == NULL || size < GET_BLK_SIZE(best))) {
+            best = seg_ptr;
+            if (size == asize)
+                break;
+        }
+        seg_ptr = SEG_NEXT_BLKP(seg_ptr);
+    }
+    if (best != NULL)
+        return best;
+
+    /* next non-empty class in this first level, or in a larger one */
+    map = (sl + 1 < SL_COUNT) ? *SL_BITMAP(fl) & (~0U << (sl + 1)) : 0;
+    if (map == 0) {
+        map = (fl + 1 < FL_COUNT) ? *FL_BITMAP & (~0U << (fl + 1)) : 0;
+        if (map == 0)
+            return tree_fit(asize);
+        fl = __builtin_ctz(map);
+        map = *SL_BITMAP(fl);
+    }
+    sl = __builtin_ctz(map);
+    return GET_SEG_LIST_PTR(seg_list_ptr, SEG_INDEX(fl, sl));
+}
+
+/*
+ * mapping - first and second level class of a block size
+ */
+static void mapping(size_t size, int *fl, int *sl)
+{
+    int msb;
+
+    if (size < (1 << FL_SHIFT)) {
+        *fl = 0;
+        *sl = size >> 3;
+    } else {
+        msb = 31 - __builtin_clz((unsigned int)size);
+        *fl = msb - FL_SHIFT + 1;
+        *sl = (size >> (msb - SL_SHIFT)) & (SL_COUNT - 1);
+    }
+}
+
+/*
+ * place - returns a pointer at best-fit position
+ */
+static void *place(void *bp, size_t asize)
+{
+    size_t csize = GET_BLK_SIZE(bp);
+    size_t padding = csize - asize;
+    unsigned int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    void *nbp = NULL;
+    remove_seglist(bp);
+
+    /* Pages just discarded are wanted again: discard less eagerly */
+    if ((GET(HDRP(bp)) & DISCARDED) && LIMITS->discard_min < MAX_HEAP)
+        LIMITS->discard_min *= 2;
+    
+    /* if the remaining is not enough */
+    if (padding < MIN_BLOCK) {
+        write_block(bp, csize, prev_alloc, 1);
+        return bp;
+    } else if (asize > MINSIZE) {
+        write_block(bp, asize, prev_alloc, 1);
+        nbp = NEXT_BLKP(bp);
+        write_block(nbp, padding, PREV_ALLOC, 0);
+        add_seglist(nbp, padding);
+        return bp;
+    } else {
+        write_block(bp, padding, prev_alloc, 0);
+        nbp = NEXT_BLKP(bp);
+        write_block(nbp, asize, 0, 1);
+        add_seglist(bp, padding);
+        return nbp;
+    }
+}
+
+/*
+ * place_aligned - allocate asize bytes of free block bp at a multiple
+ *     of alignment. The slack in front, at least MIN_BLOCK bytes, and
+ *     what is left behind, if it can be a block, become free blocks;
+ *     neither has a free neighbour to coalesce with
+ */
+static void *place_aligned(void *bp, size_t asize, size_t alignment)
+{
+    size_t csize = GET_BLK_SIZE(bp);
+    size_t slack = -(uintptr_t)bp & (alignment - 1);
+    unsigned int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+
+    if (slack != 0 && slack < MIN_BLOCK)
+        slack += alignment;
+    remove_seglist(bp);
+    if ((GET(HDRP(bp)) & DISCARDED) && LIMITS->discard_min < MAX_HEAP)
+        LIMITS->discard_min *= 2;
+
+    if (slack != 0) {
+        write_block(bp, slack, prev_alloc, 0);
+        add_seglist(bp, slack);
+        bp = (char *)bp + slack;
+        csize -= slack;
+        prev_alloc = 0;
+    }
+    if (csize - asize < MIN_BLOCK) {
+        write_block(bp, csize, prev_alloc, 1);
+    } else {
+        write_block(bp, asize, prev_alloc, 1);
+        write_block(NEXT_BLKP(bp), csize - asize, PREV_ALLOC, 0);
+        add_seglist(NEXT_BLKP(bp), csize - asize);
+    }
+    return bp;
+}
+
+/*
+ * block_alloc - allocate a block of asize bytes from the free lists,
+ *     coalescing the quick lists if nothing fits, or else from memory
+ *     the heap grows by
+ */
+static void *block_alloc(size_t asize)
+{
+    void *bp;
+
+    /* Search the free list for a fit, coalescing quick blocks if none */
+    if ((bp = find_fit(asize)) == NULL && arena->quick_map != 0) {
+        quick_flush();
+        bp = find_fit(asize);
+    }
+    /* No fit found. Get more memory and place the block */
+    if (bp == NULL && (bp = extend_heap(MAX(asize, DCHUNKSIZE)/WSIZE)) == NULL)
+        return NULL;
+    return place(bp, asize);
+}
+
+/*
+ * carve - cut free block bp into as many as n allocated blocks of
+ *     asize bytes, writing only their headers, and store them in out[].
+ *     As in place, what is left stays free after large blocks and
+ *     before small ones, unless it is too small for a block of its own.
+ *     Returns the number of blocks cut
+ */
+static int carve(void *bp, size_t asize, int n, void **out)
+{
+    size_t csize = GET_BLK_SIZE(bp);
+    size_t padding, last;
+    unsigned int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    char *p = bp;
+    int i;
+
+    remove_seglist(bp);
+    if ((GET(HDRP(bp)) & DISCARDED) && LIMITS->discard_min < MAX_HEAP)
+        LIMITS->discard_min *= 2;
+
+    n = MIN(n, csize / asize);
+    padding = csize - n * asize;
+    last = asize;
+    if (padding < MIN_BLOCK) {
+        last += padding;
+        padding = 0;
+    } else if (asize <= MINSIZE) {
+        write_block(p, padding, prev_alloc, 0);
+        add_seglist(p, padding);
+        p += padding;
+        prev_alloc = 0;
+    }
+
+    for (i = 0; i < n; i++) {
+        PUT(HDRP(p), PACK(i == n - 1 ? last : asize, prev_alloc | 1));
+        out[i] = p;
+        p += asize;
+        prev_alloc = PREV_ALLOC;
+    }
+    p += last - asize;
+
+    if (padding != 0 && asize > MINSIZE) {
+        write_block(p, padding, PREV_ALLOC, 0);
+        add_seglist(p, padding);
+    } else {
+        set_prev_alloc(p, 1);
+    }
+    return n;
+}
+
+/*
+ * quick_alloc - take a block of asize bytes off its quick list, where
+ *     it is still marked allocated, or NULL if there is none
+ */
+static void *quick_alloc(size_t asize)
+{
+    void *bp;
+
+    if (asize > QUICK_MAX || arena->quick[QUICK_BIN(asize)] == 0)
+        return NULL;
+    bp = ADDR(arena->quick[QUICK_BIN(asize)]);
+    if ((arena->quick[QUICK_BIN(asize)] = GET(bp)) == 0)
+        arena->quick_map &= ~(1U << QUICK_BIN(asize));
+    arena->quick_count--;
+    PUT(HDRP(bp), GET(HDRP(bp)) & ~QUICK);
+    return bp;
+}
+
+/*
+ * write_block - write the header, and the footer of a free block, and
+ *     tell the next block whether this one is allocated
+ */
+static void write_block(void *bp, size_t size, unsigned int prev_alloc, int alloc)
+{
+    PUT(HDRP(bp), PACK(size, prev_alloc | alloc));
+    if (!alloc)
+        PUT(FTRP(bp), PACK(size, 0));
+    set_prev_alloc(NEXT_BLKP(bp), alloc);
+}
+
+/*
+ * set_prev_alloc - update the previous-allocated bit in bp's header
+ */
+static void set_prev_alloc(void *bp, int alloc)
+{
+    if (alloc)
+        PUT(HDRP(bp), GET(HDRP(bp)) | PREV_ALLOC);
+    else
+        PUT(HDRP(bp), GET(HDRP(bp)) & ~PREV_ALLOC);
+}
+
+/*
+ * init_seglist - initialize segregated lists and their bitmaps
+ */
+static void init_seglist(void) 
+{
+    /* initialize the segregated lists */
+    arena->fl_bitmap = 0;
+    memset(arena->sl_bitmap, 0, sizeof(arena->sl_bitmap));
+    memset(arena->seg_list, 0, sizeof(arena->seg_list));
+    memset(arena->run_list, 0, sizeof(arena->run_list));
+    arena->tree_root = 0;
+    memset(arena->quick, 0, sizeof(arena->quick));
+    arena->quick_count = 0;
+    arena->quick_map = 0;
+    arena->last_grown = 0;
+    memset(LIMITS, 0, sizeof(*LIMITS));
+    LIMITS->trim_max = TRIM_MAX;
+    LIMITS->discard_min = DISCARD_MIN;
+    arena->run_map = 0;
+    arena->check_next = 0;
+    arena->check_class = 0;
+}
+
+/*
+ * add_seglist - push new free block on the list of its class
+ */
+static void add_seglist(void *bp, size_t blk_size)
+{
+    void *head;
+    int fl, sl;
+
+    if (blk_size >= TREE_MIN) {
+        arena->tree_root = tree_insert(arena->tree_root, bp);
+        return;
+    }
+    mapping(blk_size, &fl, &sl);
+    head = GET_SEG_LIST_PTR(seg_list_ptr, SEG_INDEX(fl, sl));
+
+    PUT(GET_SEG_PREV_ADR(bp), UNSIGN(NULL));
+    PUT(GET_SEG_NEXT_ADR(bp), UNSIGN(head));
+    if (head != NULL)
+        PUT(GET_SEG_PREV_ADR(head), UNSIGN(bp));
+    SET_SEG_LIST_PTR(seg_list_ptr, SEG_INDEX(fl, sl), bp);
+
+    *FL_BITMAP |= 1U << fl;
+    *SL_BITMAP(fl) |= 1U << sl;
+}
+    
+/*
+ * remove_seglist - unlink a block from its list, clearing the bitmaps
+ *     when the list becomes empty
+ */
+static void remove_seglist(void *bp)
+{
+    void *prev = SEG_PREV_BLKP(bp);
+    void *next = SEG_NEXT_BLKP(bp);
+    int fl, sl;
+
+    if (GET_BLK_SIZE(bp) >= TREE_MIN) {
+        arena->tree_root = tree_remove(arena->tree_root, bp);
+        return;
+    }
+    if (next != NULL)
+        PUT(GET_SEG_PREV_ADR(next), UNSIGN(prev));
+    if (prev != NULL) {
+        PUT(GET_SEG_NEXT_ADR(prev), UNSIGN(next));
+        return;
+    }
+
+    /* bp was the head */
+    mapping(GET_BLK_SIZE(bp), &fl, &sl);
+    SET_SEG_LIST_PTR(seg_list_ptr, SEG_INDEX(fl, sl), next);
+    if (next == NULL) {
+        *SL_BITMAP(fl) &= ~(1U << sl);
+        if (*SL_BITMAP(fl) == 0)
+            *FL_BITMAP &= ~(1U << fl);
+    }
+}
+
+/*
+ * tree_insert - insert bp in the treap under root, rotating it up while
+ *     its priority beats its parent's; returns the new root
+ */
+static unsigned int tree_insert(unsigned int root, void *bp)
+{
+    char *r = ADDR(root);
+    unsigned int child;
+
+    if (r == NULL) {
+        PUT(TREE_LEFT(bp), 0);
+        PUT(TREE_RIGHT(bp), 0);
+        return UNSIGN(bp);
+    }
+    if (TREE_LESS(bp, r)) {
+        child = tree_insert(GET(TREE_LEFT(r)), bp);
+        if (TREE_PRIO(child) > TREE_PRIO(root)) {
+            PUT(TREE_LEFT(r), GET(TREE_RIGHT(ADDR(child))));
+            PUT(TREE_RIGHT(ADDR(child)), root);
+            return child;
+        }
+        PUT(TREE_LEFT(r), child);
+    } else {
+        child = tree_insert(GET(TREE_RIGHT(r)), bp);
+        if (TREE_PRIO(child) > TREE_PRIO(root)) {
+            PUT(TREE_RIGHT(r), GET(TREE_LEFT(ADDR(child))));
+            PUT(TREE_LEFT(ADDR(child)), root);
+            return child;
+        }
+        PUT(TREE_RIGHT(r), child);
+    }
+    return root;
+}
+
+/*
+ * tree_remove - unlink bp from the treap under root, putting the merge
+ *     of its subtrees in its place; returns the new root
+ */
+static unsigned int tree_remove(unsigned int root, void *bp)
+{
+    char *r = ADDR(root);
+
+    if (r == bp)
+        return tree_merge(GET(TREE_LEFT(r)), GET(TREE_RIGHT(r)));
+    if (TREE_LESS(bp, r))
+        PUT(TREE_LEFT(r), tree_remove(GET(TREE_LEFT(r)), bp));
+    else
+        PUT(TREE_RIGHT(r), tree_remove(GET(TREE_RIGHT(r)), bp));
+    return root;
+}
+
+/*
+ * tree_merge - join two treaps whose keys are all ordered left before
+ *     right
+ */
+static unsigned int tree_merge(unsigned int left, unsigned int right)
+{
+    if (left == 0)
+        return right;
+    if (right == 0)
+        return left;
+    if (TREE_PRIO(left) > TREE_PRIO(right)) {
+        PUT(TREE_RIGHT(ADDR(left)), tree_merge(GET(TREE_RIGHT(ADDR(left))), right));
+        return left;
+    }
+    PUT(TREE_LEFT(ADDR(right)), tree_merge(left, GET(TREE_LEFT(ADDR(right)))));
+    return right;
+}
+
+/*
+ * tree_fit - the smallest large free block of at least asize bytes,
+ *     the lowest one among equals
+ */
+static void *tree_fit(size_t asize)
+{
+    char *node = ADDR(arena->tree_root);
+    void *best = NULL;
+
+    while (node != NULL) {
+        if (GET_BLK_SIZE(node) >= asize) {
+            best = node;
+            node = ADDR(GET(TREE_LEFT(node)));
+        } else {
+            node = ADDR(GET(TREE_RIGHT(node)));
+        }
+    }
+    return best;
+}
+
+/*
+ * tree_check - check order, priorities and block state in the treap
+ *     under root, counting its nodes
+ */
+static int tree_check(unsigned int root, size_t *count)
+{
+    char *r = ADDR(root);
+    char *left, *right;
+    int errno = 0;
+
+    if (r == NULL)
+        return 0;
+    (*count)++;
+    left = ADDR(GET(TREE_LEFT(r)));
+    right = ADDR(GET(TREE_RIGHT(r)));
+    if (GET_ALLOC(HDRP(r)) || GET_BLK_SIZE(r) < TREE_MIN) {
+        printf("TREE BLOCK %p NOT A LARGE FREE BLOCK\n", r);
+        errno = -1;
+    }
+    if ((left != NULL && (!TREE_LESS(left, r) || TREE_PRIO(UNSIGN(left)) > TREE_PRIO(root))) ||
+        (right != NULL && (TREE_LESS(right, r) || TREE_PRIO(UNSIGN(right)) > TREE_PRIO(root)))) {
+        printf("TREE BLOCK %p OUT OF ORDER\n", r);
+        errno = -1;
+    }
+    if (tree_check(UNSIGN(left), count) || tree_check(UNSIGN(right), count))
+        errno = -1;
+    return errno;
+}
+
+/*
+ * check_block - check one block of the arena on its own: size and
+ *     alignment, header against footer, the next block's prev-alloc
+ *     bit, no free neighbour left uncoalesced, a free block linked into
+ *     the list of its class both ways, and a run's object count
+ */
+static int check_block(void *bp)
+{
+    char *brk = (char *)mem_region_lo(arena->region) + mem_region_size(arena->region);
+    size_t size = GET_BLK_SIZE(bp);
+    void *prev, *next;
+    int errno = 0, fl, sl, idx;
+
+    if ((uintptr_t)bp % ALIGNMENT != 0 || size < MIN_BLOCK || size % ALIGNMENT != 0 ||
+        (char *)bp < heap_ptr || (char *)bp + size > brk) {
+        if (!GET_ALLOC(HDRP(bp)) && size < MIN_BLOCK)
+            printf("FREE BLOCK %p SMALLER THAN MIN_BLOCK\n", bp);
+        else
+            printf("BLOCK %p INVALID\n", bp);
+        return -1;
+    }
+    /* previous-allocated bit check */
+    if (!GET_PREV_ALLOC(HDRP(NEXT_BLKP(bp))) != !GET_ALLOC(HDRP(bp))) {
+        printf("BLOCK %p PREV ALLOC BIT OF NEXT BLOCK IS WRONG\n", bp);
+        errno = -1;
+    }
+
+    if (GET_ALLOC(HDRP(bp))) {
+        /* slab run check: object count matches the bitmap */
+        if (IS_RUN(arena, bp)) {
+            run_t *run = RUN_OF(bp);
+            int used = 0;
+            for (int i = 0; i < RUN_MAP_WORDS; i++)
+                used += __builtin_popcount(run->map[i]);
+            if ((void *)run != bp || used - (RUN_MAP_WORDS * 32 - run->count) != run->used) {
+                printf("RUN %p BITMAP AND COUNT DIFFER\n", bp);
                 errno = -1;
             }
-            /* header and footer consistency check */
-            if (GET_SIZE(HDRP(blkp)) != GET_SIZE(FTRP(blkp))) {
-                printf("FREE BLOCK %p HEADER AND FOOTER HAS DIFFERENT SIZE\n", blkp);
+        }
+        return errno;
+    }
+
+    /* header and footer consistency check */
+    if ((GET(HDRP(bp)) & ~DISCARDED) != (GET(FTRP(bp)) | GET_PREV_ALLOC(HDRP(bp)))) {
+        printf("BLOCK %p HEADER AND FOOTER DIFFER\n", bp);
+        errno = -1;
+    }
+    /* appropriate coalesce check */
+    if (!GET_ALLOC(HDRP(NEXT_BLKP(bp)))) {
+        printf("FREE BLOCK %p SHOULD BE COALESCED\n", bp);
+        errno = -1;
+    }
+    if (size >= TREE_MIN)
+        return errno;
+
+    /* on the list of its class, with links that agree both ways */
+    mapping(size, &fl, &sl);
+    idx = SEG_INDEX(fl, sl);
+    prev = SEG_PREV_BLKP(bp);
+    next = SEG_NEXT_BLKP(bp);
+    if (prev == NULL ? GET_SEG_LIST_PTR(seg_list_ptr, idx) != bp :
+        (SEG_NEXT_BLKP(prev) != bp || GET_ALLOC(HDRP(prev)) ||
+         GET_BLK_SIZE(prev) >= TREE_MIN || (mapping(GET_BLK_SIZE(prev), &fl, &sl), SEG_INDEX(fl, sl)) != idx)) {
+        printf("FREE BLOCK %p NOT LINKED FROM ITS LIST\n", bp);
+        errno = -1;
+    }
+    if (next != NULL &&
+        (SEG_PREV_BLKP(next) != bp || GET_ALLOC(HDRP(next)) ||
+         GET_BLK_SIZE(next) >= TREE_MIN || (mapping(GET_BLK_SIZE(next), &fl, &sl), SEG_INDEX(fl, sl)) != idx)) {
+        printf("FREE BLOCK %p LINKS TO A BLOCK OUTSIDE ITS LIST\n", bp);
+        errno = -1;
+    }
+    return errno;
+}
+
+/*
+ * check_epilogue - the walk ends at bp, so it must be the epilogue: a
+ *     header of size 0 marked allocated in the last word below brk
+ */
+static int check_epilogue(void *bp)
+{
+    char *brk = (char *)mem_region_lo(arena->region) + mem_region_size(arena->region);
+
+    if ((GET(HDRP(bp)) & ~PREV_ALLOC) != PACK(0, 1) || HDRP(bp) != brk - WSIZE) {
+        printf("EPILOGUE %p INVALID\n", bp);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * check_class - check that the bitmaps mark list idx non-empty exactly
+ *     when it is, and that its head has no predecessor
+ */
+static int check_class(int idx)
+{
+    void *head = GET_SEG_LIST_PTR(seg_list_ptr, idx);
+    int fl = idx / SL_COUNT, sl = idx % SL_COUNT;
+    int marked = (*FL_BITMAP >> fl & 1) && (*SL_BITMAP(fl) >> sl & 1);
+
+    if (marked != (head != NULL) || (*SL_BITMAP(fl) != 0) != (*FL_BITMAP >> fl & 1)) {
+        printf("LIST %d AND ITS BITMAP BITS DIFFER\n", idx);
+        return -1;
+    }
+    if (head != NULL && SEG_PREV_BLKP(head) != NULL) {
+        printf("LIST %d HEAD %p HAS A PREDECESSOR\n", idx, head);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * check_merged - a block that bp swallowed is no longer a block, so
+ *     mm_check_slice goes on from bp instead
+ */
+static void check_merged(void *bp)
+{
+    char *next = ADDR(arena->check_next);
+
+    if (CHECK > 0 && next > (char *)bp && next < (char *)bp + GET_BLK_SIZE(bp))
+        arena->check_next = UNSIGN(bp);
+}
+
+/*
+ * mm_check_slice - check the next n blocks of the arena with
+ *     check_block, wrapping around at the epilogue, and one list class,
+ *     so a check after every request costs O(n). The whole arena is
+ *     covered every few requests, but counts that need all of it at
+ *     once, like free blocks against list entries, are left to mm_check
+ */
+static int mm_check_slice(int n)
+{
+    char *brk = (char *)mem_region_lo(arena->region) + mem_region_size(arena->region);
+    char *bp = ADDR(arena->check_next);
+    int errno = 0;
+
+    if (check_class(arena->check_class))
+        errno = -1;
+    arena->check_class = (arena->check_class + 1) % SEG_SIZE;
+
+    /* the heap may have shrunk under the cursor */
+    if (bp == NULL || bp >= brk)
+        bp = NEXT_BLKP(heap_ptr);
+    while (n-- > 0) {
+        if (GET_SIZE(HDRP(bp)) == 0) {
+            if (check_epilogue(bp)) {
                 errno = -1;
+                break;
             }
-            /* alignment rule check */
-            if (UNSIGN(blkp) % DSIZE != 0) {
-                printf("FREE BLOCK %p SHOULD BE 8 BYTE ALIGNED\n", blkp);
-                errno = -1;
+            if ((bp = NEXT_BLKP(heap_ptr)) == brk)
+                break;                  /* no blocks at all */
+        }
+        if (check_block(bp)) {
+            errno = -1;
+            break;                      /* its size cannot be trusted */
+        }
+        bp = NEXT_BLKP(bp);
+    }
+    arena->check_next = UNSIGN(bp);
+    return errno;
+}
+
+/*
+ * mm_check - check the whole arena: every block with check_block, then
+ *     every list class and entry, that each free block is on exactly
+ *     one list, and the quick lists and the treap
+ */
+static int mm_check(void) {
+    char *brk = (char *)mem_region_lo(arena->region) + mem_region_size(arena->region);
+    int errno = 0;
+    size_t large = 0, small = 0, nodes = 0;
+    void *curr, *blkp;
+
+    /* heap valid check */
+    for (curr = NEXT_BLKP(heap_ptr); GET_SIZE(HDRP(curr)) != 0; curr = NEXT_BLKP(curr)) {
+        if (check_block(curr)) {
+            errno = -1;
+            if (GET_BLK_SIZE(curr) < MIN_BLOCK || (char *)curr + GET_BLK_SIZE(curr) > brk)
+                return errno;           /* cannot walk any further */
+        }
+        if (!GET_ALLOC(HDRP(curr))) {
+            if (GET_BLK_SIZE(curr) >= TREE_MIN)
+                large++;
+            else
+                small++;
+        }
+    }
+    if (check_epilogue(curr))
+        errno = -1;
+
+    /* segregated list valid check; entries are free blocks of the list's
+       class whose links agree (check_block), so with as many entries as
+       small free blocks, each of these is on exactly one list */
+    for (int i = 0; i < SEG_SIZE; i++) {
+        if (check_class(i))
+            errno = -1;
+        for (blkp = GET_SEG_LIST_PTR(seg_list_ptr, i); blkp != NULL; blkp = SEG_NEXT_BLKP(blkp)) {
+            if (GET_ALLOC(HDRP(blkp)) || check_block(blkp)) {
+                printf("FREE BLOCK %p ON LIST %d INVALID\n", blkp, i);
+                return -1;                  /* the list cannot be followed */
             }
-            nblkp = SEG_PREV_BLKP(blkp);
-            /* appropriate coalesce check*/
-            if (nblkp != NULL && HDRP(blkp) - FTRP(blkp) == DSIZE) {
-                printf("FREE BLOCK %p SHOULD BE COALESCED\n", blkp);
+            if (++nodes > small)
+                break;
+        }
+    }
+    if (nodes != small) {
+        printf("LISTS HOLD %zu BLOCKS, NOT %zu\n", nodes, small);
+        errno = -1;
+    }
+    nodes = 0;
+
+    /* quick list check: blocks still marked allocated, count right */
+    for (int i = 0; i < QUICK_BINS; i++) {
+        for (blkp = ADDR(arena->quick[i]); blkp != NULL; blkp = ADDR(GET(blkp))) {
+            if (!(GET(HDRP(blkp)) & QUICK) || QUICK_BIN(GET_BLK_SIZE(blkp)) != i) {
+                printf("QUICK BLOCK %p WRONG SIZE OR NOT MARKED\n", blkp);
                 errno = -1;
             }
-            blkp = nblkp;
+            nodes++;
         }
-    }    
+    }
+    if (nodes != arena->quick_count) {
+        printf("QUICK LISTS HOLD %zu BLOCKS, NOT %u\n", nodes, arena->quick_count);
+        errno = -1;
+    }
+    nodes = 0;
+
+    /* treap valid check, and every large free block in it */
+    if (tree_check(arena->tree_root, &nodes) || nodes != large) {
+        printf("TREAP INVALID: %zu OF %zu LARGE FREE BLOCKS\n", nodes, large);
+        errno = -1;
+    }
     return errno;
 }
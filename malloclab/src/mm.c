@@ -23,11 +23,13 @@
  * provide your team information in the following struct.
  ********************************************************/
 
-/* single word (4) or double word (8) alignment */
+/* double word (8) or quad word (16) alignment, set with -DALIGNMENT */
+#ifndef ALIGNMENT
 #define ALIGNMENT 8
+#endif
 
 /* rounds up to the nearest multiple of ALIGNMENT */
-#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(ALIGNMENT-1))
 
 
 #define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
@@ -83,16 +85,86 @@ void *mm_realloc(void *ptr, size_t size)
     return newptr;
 }
 
+/*
+ * mm_malloc_batch - One mm_malloc after another.
+ */
+int mm_malloc_batch(size_t size, int n, void **out)
+{
+    int i;
 
+    for (i = 0; i < n && (out[i] = mm_malloc(size)) != NULL; i++)
+        ;
+    return i;
+}
 
+/*
+ * mm_free_batch - Freeing blocks does nothing.
+ */
+void mm_free_batch(void **ptrs, int n)
+{
+}
 
+/*
+ * mm_memalign - Pad the block so that its payload lands on the
+ *     boundary; the padding is never used again.
+ */
+void *mm_memalign(size_t alignment, size_t size)
+{
+    size_t pad;
+
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+        return NULL;
+    if (alignment <= ALIGNMENT)
+        return mm_malloc(size);
+    pad = -((size_t)mem_sbrk(0) + 2 * SIZE_T_SIZE) & (alignment - 1);
+    if (mm_malloc(pad) == NULL)
+        return NULL;
+    return mm_malloc(size);
+}
 
+/*
+ * mm_calloc - mm_malloc, then zero the payload.
+ */
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    void *p;
 
+    if (nmemb != 0 && size > (size_t)-1 / nmemb)
+        return NULL;
+    if ((p = mm_malloc(nmemb * size)) != NULL)
+        memset(p, 0, nmemb * size);
+    return p;
+}
 
+/*
+ * mm_free_sized - Freeing a block does nothing.
+ */
+void mm_free_sized(void *ptr, size_t size)
+{
+}
 
+/*
+ * mm_lock_stats - This package takes no locks, so it never waits.
+ */
+void mm_lock_stats(unsigned long *waits, double *secs)
+{
+    *waits = 0;
+    *secs = 0;
+}
 
-
-
-
-
-
+/*
+ * mm_heap_walk - The cursor is the block last reported. Nothing is
+ *     ever freed, so every block is allocated.
+ */
+void *mm_heap_walk(void *cursor, mm_block_t *block)
+{
+    char *p = cursor ? (char *)cursor + ALIGN(*(size_t *)cursor + SIZE_T_SIZE)
+                     : mem_heap_lo();
+
+    if (mem_heapsize() == 0 || p > (char *)mem_heap_hi())
+        return NULL;
+    block->addr = p;
+    block->size = ALIGN(*(size_t *)p + SIZE_T_SIZE);
+    block->state = MM_BLOCK_ALLOC;
+    return p;
+}
@@ -4,6 +4,44 @@ extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void mm_lock_stats(unsigned long *waits, double *secs);
+
+/*
+ * mm_malloc_batch allocates n blocks of size bytes each into out[] and
+ * returns how many it got, fewer than n only when memory runs out.
+ * mm_free_batch frees n blocks at once; it sorts ptrs by address.
+ */
+extern int mm_malloc_batch(size_t size, int n, void **out);
+extern void mm_free_batch(void **ptrs, int n);
+
+/*
+ * mm_memalign returns a block of size bytes at a multiple of alignment,
+ * a power of two, or NULL if alignment is not one. mm_calloc returns
+ * nmemb * size zeroed bytes, or NULL if the product overflows.
+ * mm_free_sized frees a block given the size last asked for it, or
+ * less, which may spare the package looking the size up.
+ */
+extern void *mm_memalign(size_t alignment, size_t size);
+extern void *mm_calloc(size_t nmemb, size_t size);
+extern void mm_free_sized(void *ptr, size_t size);
+
+/*
+ * One block of the heap, as mm_heap_walk reports it: addr is where the
+ * block starts, header included, and size its whole length. CACHED
+ * blocks are free but held back from other requests, e.g. on a list
+ * of recently freed blocks of their size. mm_heap_walk(NULL, &b) gives
+ * the first block and returns a cursor to pass on for the next one,
+ * in address order, and NULL once there are no more.
+ */
+enum {MM_BLOCK_ALLOC, MM_BLOCK_FREE, MM_BLOCK_CACHED};
+
+typedef struct {
+    void *addr;
+    size_t size;
+    int state;
+} mm_block_t;
+
+extern void *mm_heap_walk(void *cursor, mm_block_t *block);
 
 
 /* 
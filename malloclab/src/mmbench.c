@@ -0,0 +1,132 @@
+/*
+ * mmbench.c - multithreaded malloc/free churn against the mm package
+ *             or libc malloc
+ *
+ * Each thread owns SLOTS slots and repeatedly frees a random slot and
+ * fills it with a new block of random size. With -x, that percentage of
+ * the frees instead takes a block out of the next thread's slots, so
+ * blocks are freed by a thread other than the one that allocated them.
+ *
+ * usage: mmbench [-l] [-t threads] [-n ops per thread] [-x remote %]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define SLOTS 1024
+#define MAX_THREADS 64
+#define MAX_SIZE 512
+
+static int use_libc = 0;
+static int nops = 1000000;
+static int remote = 0;
+static int nthreads = 4;
+static void *slots[MAX_THREADS][SLOTS];
+
+static void *bench_malloc(size_t size)
+{
+    return use_libc ? malloc(size) : mm_malloc(size);
+}
+
+static void bench_free(void *ptr)
+{
+    if (use_libc)
+        free(ptr);
+    else
+        mm_free(ptr);
+}
+
+static void *worker(void *vargp)
+{
+    int id = (int)(long)vargp;
+    unsigned int seed = id + 1;
+    void **mine = slots[id];
+    void **theirs = slots[(id + 1) % nthreads];
+    int i, k;
+    void *p;
+
+    for (i = 0; i < nops; i++) {
+        k = rand_r(&seed) % SLOTS;
+        if (rand_r(&seed) % 100 < remote)
+            p = __sync_lock_test_and_set(&theirs[k], NULL);
+        else
+            p = __sync_lock_test_and_set(&mine[k], NULL);
+        if (p)
+            bench_free(p);
+        if ((p = bench_malloc(1 + rand_r(&seed) % MAX_SIZE)) == NULL) {
+            fprintf(stderr, "mmbench: out of memory\n");
+            exit(1);
+        }
+        *(char *)p = id;
+        if ((p = __sync_lock_test_and_set(&mine[k], p)) != NULL)
+            bench_free(p);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t tids[MAX_THREADS];
+    struct timeval start, end;
+    double secs;
+    int c, i, k;
+
+    while ((c = getopt(argc, argv, "lt:n:x:")) != EOF) {
+        switch (c) {
+        case 'l':
+            use_libc = 1;
+            break;
+        case 't':
+            nthreads = atoi(optarg);
+            break;
+        case 'n':
+            nops = atoi(optarg);
+            break;
+        case 'x':
+            remote = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-l] [-t threads] [-n ops] [-x remote %%]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (nthreads < 1 || nthreads > MAX_THREADS) {
+        fprintf(stderr, "mmbench: 1 to %d threads\n", MAX_THREADS);
+        exit(1);
+    }
+
+    if (!use_libc) {
+        mem_init();
+        if (mm_init() < 0) {
+            fprintf(stderr, "mmbench: mm_init failed\n");
+            exit(1);
+        }
+    }
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < nthreads; i++)
+        pthread_create(&tids[i], NULL, worker, (void *)(long)i);
+    for (i = 0; i < nthreads; i++)
+        pthread_join(tids[i], NULL);
+    gettimeofday(&end, NULL);
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+
+    for (i = 0; i < nthreads; i++)
+        for (k = 0; k < SLOTS; k++)
+            if (slots[i][k])
+                bench_free(slots[i][k]);
+
+    printf("%s: %d threads, %d%% remote frees, %.0f Kops/s",
+           use_libc ? "libc" : "mm", nthreads, remote,
+           2.0 * nthreads * nops / secs / 1e3);
+    if (!use_libc)
+        printf(", heap %zu kB", mem_heapsize() / 1024);
+    printf("\n");
+    return 0;
+}
@@ -0,0 +1,300 @@
+/*
+ * mmtrace.c - capture the malloc calls of a process for mdriver
+ *
+ * Preload the library built from this file, libmmtrace.so, to log
+ * every malloc, calloc, realloc and free of a program:
+ *
+ *     LD_PRELOAD=./libmmtrace.so MMTRACE=out program args
+ *
+ * Each thread fills a buffer of MMTRACE_BUF records (see mmtrace.h)
+ * and appends it to out.<pid>.<thread> when it is full, when the
+ * thread exits and when the process exits. The calls themselves go to
+ * the next malloc in line, as found by dlsym(RTLD_NEXT). log2rep turns
+ * the logs into a tracefile. MMTRACE defaults to "mmtrace".
+ *
+ * The library never calls malloc itself: buffers come from mmap, and
+ * the calloc that dlsym makes before the real one is known is served
+ * from a static area. Calls made while the thread is already inside
+ * the library, e.g. from a signal handler, are passed on unlogged.
+ */
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "mmtrace.h"
+
+#define BOOT_SIZE 4096     /* static area for calls made during dlsym */
+#define TLS __thread __attribute__((tls_model("initial-exec")))
+
+/* one thread's records not yet written to its log */
+typedef struct buf_t {
+    int fd;                 /* its log, opened at the first flush */
+    uint32_t tid;
+    int n;                  /* records in rec */
+    struct buf_t *next;     /* list of all buffers, for the last flush */
+    mmtrace_rec_t rec[MMTRACE_BUF];
+} buf_t;
+
+/* the real functions */
+static void *(*mallocp)(size_t size);
+static void *(*callocp)(size_t nmemb, size_t size);
+static void *(*reallocp)(void *ptr, size_t size);
+static void (*freep)(void *ptr);
+
+static char boot[BOOT_SIZE] __attribute__((aligned(16)));
+static size_t boot_used = 0;
+static int resolving = 0;
+
+static char prefix[256] = "mmtrace";
+static uint64_t seq = 0;
+static uint32_t num_threads = 0;
+static buf_t *bufs = NULL;
+static pthread_mutex_t bufs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t buf_key;
+
+static TLS buf_t *buf = NULL;
+static TLS int busy = 0;
+
+static void flush(buf_t *b)
+{
+    char path[300];
+    size_t len, done;
+    ssize_t w;
+
+    if (b->n == 0)
+        return;
+    if (b->fd < 0) {
+        snprintf(path, sizeof(path), "%s.%d.%u", prefix, (int)getpid(), b->tid);
+        if ((b->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+            fprintf(stderr, "mmtrace: %s: %s\n", path, strerror(errno));
+            _exit(1);
+        }
+    }
+    len = b->n * sizeof(mmtrace_rec_t);
+    for (done = 0; done < len; done += w)
+        if ((w = write(b->fd, (char *)b->rec + done, len - done)) < 0) {
+            if (errno == EINTR) {
+                w = 0;
+                continue;
+            }
+            fprintf(stderr, "mmtrace: write: %s\n", strerror(errno));
+            _exit(1);
+        }
+    b->n = 0;
+}
+
+/* thread_exit - flush the buffer of an exiting thread */
+static void thread_exit(void *vb)
+{
+    busy = 1;
+    flush(vb);
+    busy = 0;
+}
+
+/* get_buf - the calling thread's buffer, created at its first call */
+static buf_t *get_buf(void)
+{
+    buf_t *b;
+
+    if (buf)
+        return buf;
+    b = mmap(NULL, sizeof(buf_t), PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (b == MAP_FAILED) {
+        fprintf(stderr, "mmtrace: out of memory\n");
+        _exit(1);
+    }
+    b->fd = -1;
+    b->n = 0;
+    pthread_mutex_lock(&bufs_lock);
+    b->tid = num_threads++;
+    b->next = bufs;
+    bufs = b;
+    pthread_mutex_unlock(&bufs_lock);
+    pthread_setspecific(buf_key, b);
+    return buf = b;
+}
+
+/* log_begin - take the next record and its place in the call order */
+static mmtrace_rec_t *log_begin(void)
+{
+    buf_t *b = get_buf();
+    mmtrace_rec_t *r = &b->rec[b->n];
+
+    r->seq = __sync_fetch_and_add(&seq, 1);
+    return r;
+}
+
+/* log_end - fill in the record from log_begin and keep it */
+static void log_end(mmtrace_rec_t *r, int type, void *ptr, void *old, size_t size)
+{
+    r->ptr = (uintptr_t)ptr;
+    r->old = (uintptr_t)old;
+    r->size = size;
+    r->type = type;
+    r->tid = buf->tid;
+    if (++buf->n == MMTRACE_BUF)
+        flush(buf);
+}
+
+static void log_call(int type, void *ptr, void *old, size_t size)
+{
+    log_end(log_begin(), type, ptr, old, size);
+}
+
+/* after a fork, the child starts new logs under its own pid */
+static void child_fork(void)
+{
+    buf_t *b;
+
+    for (b = bufs; b; b = b->next) {
+        if (b->fd >= 0)
+            close(b->fd);
+        b->fd = -1;
+        b->n = 0;
+    }
+}
+
+static void resolve(void)
+{
+    resolving = 1;
+    mallocp = dlsym(RTLD_NEXT, "malloc");
+    callocp = dlsym(RTLD_NEXT, "calloc");
+    reallocp = dlsym(RTLD_NEXT, "realloc");
+    freep = dlsym(RTLD_NEXT, "free");
+    resolving = 0;
+    if (!mallocp || !callocp || !reallocp || !freep) {
+        fprintf(stderr, "mmtrace: %s\n", dlerror());
+        _exit(1);
+    }
+}
+
+/* boot_alloc - serve the calls dlsym makes before the real functions are known */
+static void *boot_alloc(size_t size)
+{
+    void *p;
+
+    size = (size + 15) & ~(size_t)15;
+    if (boot_used + size > BOOT_SIZE)
+        return NULL;
+    p = boot + boot_used;
+    boot_used += size;
+    return p;
+}
+
+#define IS_BOOT(p) ((char *)(p) >= boot && (char *)(p) < boot + BOOT_SIZE)
+
+void *malloc(size_t size)
+{
+    void *p;
+
+    if (!mallocp) {
+        if (resolving)
+            return boot_alloc(size);
+        resolve();
+    }
+    if (busy)
+        return mallocp(size);
+    busy = 1;
+    p = mallocp(size);
+    if (p)
+        log_call(MMTRACE_MALLOC, p, NULL, size);
+    busy = 0;
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (!callocp) {
+        if (resolving)
+            return boot_alloc(nmemb * size);   /* static, so zeroed */
+        resolve();
+    }
+    if (busy)
+        return callocp(nmemb, size);
+    busy = 1;
+    p = callocp(nmemb, size);
+    if (p)
+        log_call(MMTRACE_CALLOC, p, NULL, nmemb * size);
+    busy = 0;
+    return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    mmtrace_rec_t *r;
+    void *p;
+    size_t n;
+
+    if (!reallocp)
+        resolve();
+    if (IS_BOOT(ptr)) {
+        /* never logged, so let it look like a fresh block */
+        n = boot + BOOT_SIZE - (char *)ptr;
+        if ((p = malloc(size)) != NULL)
+            memcpy(p, ptr, size < n ? size : n);
+        return p;
+    }
+    if (busy)
+        return reallocp(ptr, size);
+    busy = 1;
+    /* ordered before the call, like free: ptr may be handed out again first */
+    r = log_begin();
+    p = reallocp(ptr, size);
+    if (p || size == 0)
+        log_end(r, MMTRACE_REALLOC, p, ptr, size);
+    busy = 0;
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL || IS_BOOT(ptr))
+        return;
+    if (!freep)
+        resolve();
+    if (busy) {
+        freep(ptr);
+        return;
+    }
+    busy = 1;
+    /* logged first: once freed, another thread may get ptr back */
+    log_call(MMTRACE_FREE, ptr, NULL, 0);
+    freep(ptr);
+    busy = 0;
+}
+
+__attribute__((constructor))
+static void init(void)
+{
+    char *env;
+
+    if ((env = getenv("MMTRACE")) != NULL)
+        snprintf(prefix, sizeof(prefix), "%s", env);
+    pthread_key_create(&buf_key, thread_exit);
+    pthread_atfork(NULL, NULL, child_fork);
+    if (!mallocp)
+        resolve();
+}
+
+__attribute__((destructor))
+static void fini(void)
+{
+    buf_t *b;
+
+    busy = 1;
+    pthread_mutex_lock(&bufs_lock);
+    for (b = bufs; b; b = b->next)
+        flush(b);
+    pthread_mutex_unlock(&bufs_lock);
+}
@@ -0,0 +1,22 @@
+/*
+ * mmtrace.h - log records written by the mmtrace capture library
+ *
+ * Every thread of a traced process buffers its records and appends
+ * them to a log file of its own. seq numbers the calls of all threads
+ * in the order they took effect, so that merging the logs by seq gives
+ * a trace that can be replayed on one thread.
+ */
+#include <stdint.h>
+
+#define MMTRACE_BUF  4096   /* records buffered per thread */
+
+enum {MMTRACE_MALLOC, MMTRACE_CALLOC, MMTRACE_REALLOC, MMTRACE_FREE};
+
+typedef struct {
+    uint64_t seq;
+    uint64_t ptr;       /* block returned, or block freed */
+    uint64_t old;       /* block passed to realloc */
+    uint64_t size;      /* bytes asked for; 0 for free */
+    uint32_t type;
+    uint32_t tid;       /* index of the thread, in order of its first call */
+} mmtrace_rec_t;
@@ -0,0 +1,101 @@
+/*
+ * rep2bin.c - convert a malloc lab tracefile to the binary format
+ *
+ * Reads a .rep file and writes the same requests as a binary trace
+ * (see tracebin.h), which mdriver decodes instead of parsing. The ids
+ * are checked the way mdriver checks them: every request names an
+ * id below the count in the header, and the largest one is in use.
+ * Batch markers are copied as they are.
+ *
+ * usage: rep2bin in.rep out.bin
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "tracebin.h"
+
+int main(int argc, char **argv)
+{
+    FILE *in, *out;
+    tracebin_hdr_t hdr;
+    tracebin_op_t *ops;
+    char type[2];
+    int i, max_id = -1;
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: rep2bin in.rep out.bin\n");
+        exit(1);
+    }
+    if ((in = fopen(argv[1], "r")) == NULL) {
+        perror(argv[1]);
+        exit(1);
+    }
+    hdr.magic = TRACEBIN_MAGIC;
+    hdr.version = TRACEBIN_VERSION;
+    if (fscanf(in, "%d %d %d %d", &hdr.sugg_heapsize, &hdr.num_ids,
+               &hdr.num_ops, &hdr.weight) != 4 || hdr.num_ops < 0) {
+        fprintf(stderr, "rep2bin: %s: bad header\n", argv[1]);
+        exit(1);
+    }
+    if ((ops = malloc((hdr.num_ops + 1) * sizeof(tracebin_op_t))) == NULL) {
+        fprintf(stderr, "rep2bin: out of memory\n");
+        exit(1);
+    }
+
+    for (i = 0; i < hdr.num_ops; i++) {
+        if (fscanf(in, "%1s %d", type, &ops[i].index) != 2)
+            break;
+        ops[i].size = 0;
+        if (type[0] == 'a')
+            ops[i].type = TRACEBIN_ALLOC;
+        else if (type[0] == 'r')
+            ops[i].type = TRACEBIN_REALLOC;
+        else if (type[0] == 'f')
+            ops[i].type = TRACEBIN_FREE;
+        else if (type[0] == 'c')
+            ops[i].type = TRACEBIN_CALLOC;
+        else if (type[0] == 's')
+            ops[i].type = TRACEBIN_FREE_SIZED;
+        else if (type[0] == 'b') {
+            ops[i].type = TRACEBIN_BATCH;   /* index is the batch length */
+            continue;
+        } else if (type[0] == 'm') {
+            ops[i].type = TRACEBIN_MEMALIGN;  /* index is the alignment */
+            continue;
+        } else {
+            fprintf(stderr, "rep2bin: %s: bogus request %c\n", argv[1], type[0]);
+            exit(1);
+        }
+        if (type[0] != 'f' && fscanf(in, "%d", &ops[i].size) != 1)
+            break;
+        if (ops[i].index < 0 || ops[i].index >= hdr.num_ids) {
+            fprintf(stderr, "rep2bin: %s: request %d: id %d out of range\n",
+                    argv[1], i, ops[i].index);
+            exit(1);
+        }
+        if (ops[i].index > max_id)
+            max_id = ops[i].index;
+    }
+    if (i != hdr.num_ops || fscanf(in, "%1s", type) != EOF) {
+        fprintf(stderr, "rep2bin: %s: expected %d requests\n", argv[1], hdr.num_ops);
+        exit(1);
+    }
+    if (max_id != hdr.num_ids - 1) {
+        fprintf(stderr, "rep2bin: %s: %d ids in the header, %d used\n",
+                argv[1], hdr.num_ids, max_id + 1);
+        exit(1);
+    }
+    fclose(in);
+
+    if ((out = fopen(argv[2], "w")) == NULL) {
+        perror(argv[2]);
+        exit(1);
+    }
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1 ||
+        tracebin_write(out, ops, hdr.num_ops) != hdr.num_ops ||
+        fclose(out) != 0) {
+        perror(argv[2]);
+        exit(1);
+    }
+    return 0;
+}
@@ -0,0 +1,80 @@
+/*
+ * tracebin.c - write and read the records of a binary trace
+ *
+ * See tracebin.h for the format.
+ */
+#include <stdint.h>
+#include <stdio.h>
+
+#include "tracebin.h"
+
+#define MAX_REC 11   /* type byte and two five-byte varints */
+
+/* has_size - does a record of this type carry a size? */
+static int has_size(int type)
+{
+    return type != TRACEBIN_FREE && type != TRACEBIN_BATCH &&
+        type != TRACEBIN_MEMALIGN;
+}
+
+static unsigned char *put_varint(unsigned char *p, uint32_t v)
+{
+    for (; v >= 0x80; v >>= 7)
+        *p++ = v | 0x80;
+    *p++ = v;
+    return p;
+}
+
+/*
+ * tracebin_write - write num_ops records to out; returns the number
+ *     written, which is num_ops unless a write failed
+ */
+int tracebin_write(FILE *out, const tracebin_op_t *ops, int num_ops)
+{
+    unsigned char buf[MAX_REC], *p;
+    int i;
+
+    for (i = 0; i < num_ops; i++) {
+        buf[0] = ops[i].type;
+        p = put_varint(buf + 1, ops[i].index);
+        if (has_size(ops[i].type))
+            p = put_varint(p, ops[i].size);
+        if (fwrite(buf, p - buf, 1, out) != 1)
+            break;
+    }
+    return i;
+}
+
+static const unsigned char *
+get_varint(const unsigned char *p, const unsigned char *end, int32_t *v)
+{
+    uint32_t x = 0;
+    int shift;
+
+    for (shift = 0; p < end && shift < 32; shift += 7) {
+        x |= (uint32_t)(*p & 0x7f) << shift;
+        if (!(*p++ & 0x80)) {
+            *v = x;
+            return x > INT32_MAX ? NULL : p;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * tracebin_read - decode the record at p, which must end by end, into
+ *     op; returns the start of the next record, or NULL if the record
+ *     is cut short or does not fit an int
+ */
+const unsigned char *
+tracebin_read(const unsigned char *p, const unsigned char *end, tracebin_op_t *op)
+{
+    if (p >= end)
+        return NULL;
+    op->type = *p++;
+    op->size = 0;
+    if ((p = get_varint(p, end, &op->index)) != NULL &&
+        has_size(op->type))
+        p = get_varint(p, end, &op->size);
+    return p;
+}
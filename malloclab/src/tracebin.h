@@ -0,0 +1,53 @@
+/*
+ * tracebin.h - binary tracefile format
+ *
+ * A binary trace holds the same requests as a .rep file in less space
+ * than the text, and without the number parsing: a header, then
+ * num_ops packed records. A record is one byte of type followed by
+ * its index and, for the types that carry one, its size, each as an
+ * unsigned varint (seven bits a byte, low bits first, the top bit set
+ * on every byte but the last). The type of a record is one of
+ * TRACEBIN_ALLOC, TRACEBIN_FREE and TRACEBIN_REALLOC; a free has no
+ * size. rep2bin writes these files from .rep files, and mdriver maps
+ * them and decodes the records into its request array.
+ *
+ * A TRACEBIN_BATCH record, "b <n>" in a .rep file, makes the n records
+ * after it one batch: allocations of one size, which mdriver replays
+ * with mm_malloc_batch, or frees, replayed with mm_free_batch. Its
+ * index is n, it has no size, and it is not counted as a request.
+ *
+ * TRACEBIN_CALLOC, "c <id> <size>", allocates zeroed memory, and
+ * TRACEBIN_FREE_SIZED, "s <id> <size>", frees a block passing the size
+ * it was last allocated or reallocated with. A TRACEBIN_MEMALIGN
+ * record, "m <alignment>", makes the allocation after it one at a
+ * multiple of the alignment, a power of two. Like a batch, its index
+ * is the alignment, it has no size, and it is not counted.
+ */
+#include <stdint.h>
+#include <stdio.h>
+
+#define TRACEBIN_MAGIC   0x5254424d   /* "MBTR" */
+#define TRACEBIN_VERSION 2
+
+enum {TRACEBIN_ALLOC, TRACEBIN_FREE, TRACEBIN_REALLOC, TRACEBIN_BATCH,
+      TRACEBIN_CALLOC, TRACEBIN_FREE_SIZED, TRACEBIN_MEMALIGN};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int32_t sugg_heapsize;   /* the four numbers of the .rep header */
+    int32_t num_ids;
+    int32_t num_ops;
+    int32_t weight;
+} tracebin_hdr_t;
+
+/* A record as the tools hold it before writing or after reading it */
+typedef struct {
+    int32_t type;
+    int32_t index;
+    int32_t size;
+} tracebin_op_t;
+
+int tracebin_write(FILE *out, const tracebin_op_t *ops, int num_ops);
+const unsigned char *tracebin_read(const unsigned char *p,
+                                   const unsigned char *end, tracebin_op_t *op);
@@ -0,0 +1,402 @@
+/*
+ * tracegen.c - write synthetic malloc lab tracefiles
+ *
+ * The original default tracefiles are not shipped with this handout.
+ * Each pattern below reproduces the shape of one of them: the four
+ * program traces (amptjp, cccp, cp-decl, expr) as a random mix of
+ * small and medium blocks with random lifetimes, and the remaining
+ * ones as the fixed allocation patterns they are known for. Every
+ * trace is balanced, i.e. it frees all of its blocks at the end.
+ *
+ * usage: tracegen [-s seed] [-n count] <pattern> > file.rep
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAXOPS (1 << 24)
+
+/* one trace request, as written to the tracefile */
+typedef struct {
+    char type;              /* 'a', 'f', 'r', 'b', 'c', 's' or 'm' */
+    int id;
+    int size;
+} op_t;
+
+static op_t *ops;
+static int num_ops = 0;
+static int num_ids = 0;
+static int heap_hint = 0;   /* written as the suggested heap size */
+
+static int *live;           /* ids allocated and not yet freed */
+static int num_live = 0;
+
+static void emit(char type, int id, int size)
+{
+    if (num_ops == MAXOPS) {
+        fprintf(stderr, "tracegen: too many ops\n");
+        exit(1);
+    }
+    ops[num_ops].type = type;
+    ops[num_ops].id = id;
+    ops[num_ops].size = size;
+    num_ops++;
+    if (type == 'b' || type == 'm')
+        return;             /* id is the batch length or the alignment */
+    if (type == 'f' || type == 's')
+        return;
+    if (id >= num_ids)
+        num_ids = id + 1;
+    heap_hint += size;
+}
+
+/* allocate a fresh id and remember it as live */
+static int alloc(int size)
+{
+    int id = num_ids;
+    emit('a', id, size);
+    live[num_live++] = id;
+    return id;
+}
+
+/* free the i-th live id */
+static void free_live(int i)
+{
+    emit('f', live[i], 0);
+    live[i] = live[--num_live];
+}
+
+static void free_all(void)
+{
+    while (num_live > 0)
+        free_live(0);
+}
+
+static int uniform(int lo, int hi)
+{
+    return lo + rand() % (hi - lo + 1);
+}
+
+/*
+ * program - n blocks, sizes drawn from a small/medium/large mix given
+ *   in percent, freed in random order while new ones are allocated
+ */
+static void program(int n, int small, int medium)
+{
+    while (num_ids < n) {
+        if (num_live > 0 && rand() % 100 < 40) {
+            free_live(rand() % num_live);
+            continue;
+        }
+        int r = rand() % 100;
+        if (r < small)
+            alloc(uniform(1, 128));
+        else if (r < small + medium)
+            alloc(uniform(129, 1024));
+        else
+            alloc(uniform(1025, 8192));
+    }
+    free_all();
+}
+
+/* coalescing - two neighbours freed, then asked for as one block */
+static void coalescing(int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        alloc(4095);
+        alloc(4095);
+        free_live(0);
+        free_live(0);
+        alloc(8190);
+        free_live(0);
+    }
+}
+
+/* random - random sizes up to max, random lifetimes */
+static void random_sizes(int n, int max)
+{
+    while (num_ids < n) {
+        if (num_live > 0 && rand() % 2)
+            free_live(rand() % num_live);
+        else
+            alloc(uniform(1, max));
+    }
+    free_all();
+}
+
+/*
+ * binary - alternate small and large blocks, free every large one and
+ *   ask for blocks slightly larger than the holes left behind
+ */
+static void binary(int n, int small, int large)
+{
+    int i, first = num_ids;
+
+    for (i = 0; i < n; i++) {
+        alloc(small);
+        alloc(large);
+    }
+    for (i = 0; i < n; i++)
+        emit('f', first + 2*i + 1, 0);
+    num_live = 0;
+    for (i = 0; i < n; i++)
+        live[num_live++] = first + 2*i;
+    for (i = 0; i < n; i++)
+        alloc(large + small);
+    free_all();
+}
+
+/* small - many tiny blocks of 8 to 64 bytes with random lifetimes */
+static void small(int n)
+{
+    while (num_ids < n) {
+        if (num_live > 0 && rand() % 100 < 45)
+            free_live(rand() % num_live);
+        else
+            alloc(uniform(8, 64));
+    }
+    free_all();
+}
+
+/*
+ * large - blocks of 4 to 128 KB with random lifetimes, each followed by a
+ *   short-lived spacer so that the holes they leave rarely coalesce
+ */
+static void large(int n)
+{
+    while (num_ids < n) {
+        if (num_live > 0 && rand() % 100 < 60) {
+            free_live(rand() % num_live);
+            continue;
+        }
+        alloc(uniform(4096, 131072));
+        alloc(uniform(100, 200));
+    }
+    free_all();
+}
+
+/*
+ * huge - blocks of 256 KB to 2 MB with random lifetimes, a third of them
+ *   grown by realloc a few times, each followed by a short-lived spacer
+ */
+static void huge(int n)
+{
+    int id, size, k;
+
+    while (num_ids < n) {
+        if (num_live > 16 || (num_live > 0 && rand() % 100 < 45)) {
+            free_live(rand() % num_live);
+            continue;
+        }
+        size = uniform(262144, 2097152);
+        id = alloc(size);
+        if (rand() % 3 == 0)
+            for (k = uniform(1, 4); k > 0; k--)
+                emit('r', id, size += size / 4);
+        alloc(uniform(100, 200));
+    }
+    free_all();
+}
+
+/*
+ * tail - a block at the top of the heap grown a word or two at a time
+ *   by realloc, so the heap grows by less than a free block, and freed
+ *   before a larger request that takes in the top of the heap
+ */
+static void tail(int n)
+{
+    int id, size, k;
+
+    while (num_ids < n) {
+        size = uniform(72, 190);
+        id = alloc(size);
+        for (k = uniform(1, 4); k > 0; k--)
+            emit('r', id, size += uniform(1, 2) * 4);
+        free_live(num_live - 1);
+        alloc(uniform(2048, 8192));
+        free_live(num_live - 1);
+    }
+}
+
+/*
+ * batch - messages of 8 to 64 objects of one size, allocated as one
+ *   batch and, after a few more messages, freed as one in random order
+ */
+static void batch(int n)
+{
+    static const int sizes[] = {24, 48, 72, 96, 160, 256, 400};
+    int first[64], count[64];
+    int msgs = 0, i, k, size;
+
+    while (num_ids < n) {
+        if (msgs == 64 || (msgs > 0 && rand() % 100 < 45)) {
+            i = rand() % msgs;
+            emit('b', count[i], 0);
+            for (k = 0; k < count[i]; k++)
+                emit('f', first[i] + k, 0);
+            first[i] = first[--msgs];
+            count[i] = count[msgs];
+            continue;
+        }
+        first[msgs] = num_ids;
+        count[msgs] = uniform(8, 64);
+        size = sizes[rand() % 7];
+        emit('b', count[msgs], 0);
+        for (k = 0; k < count[msgs]; k++)
+            emit('a', first[msgs] + k, size);
+        msgs++;
+    }
+    while (msgs > 0) {
+        msgs--;
+        emit('b', count[msgs], 0);
+        for (k = 0; k < count[msgs]; k++)
+            emit('f', first[msgs] + k, 0);
+    }
+}
+
+/*
+ * api - blocks of 16 to 8192 bytes with random lifetimes, a third of
+ *   them from calloc and one in eight aligned to 32 to 4096 bytes, and
+ *   now and then one of 256 to 512 KB; half of the frees give the size
+ */
+static void api(int n)
+{
+    int *sizes = malloc((n + 1) * sizeof(int));
+    int i, id, size, kind;
+
+    if (sizes == NULL) {
+        fprintf(stderr, "tracegen: out of memory\n");
+        exit(1);
+    }
+    while (num_ids < n) {
+        if (num_live > 200 || (num_live > 0 && rand() % 100 < 45)) {
+            i = rand() % num_live;
+            if (rand() % 2)
+                emit('s', live[i], sizes[live[i]]);
+            else
+                emit('f', live[i], 0);
+            live[i] = live[--num_live];
+            continue;
+        }
+        size = rand() % 50 ? uniform(16, 8192) : uniform(262144, 524288);
+        id = num_ids;
+        kind = rand() % 24;
+        if (kind < 8) {
+            emit('c', id, size);
+        } else {
+            if (kind < 11)
+                emit('m', 32 << rand() % 8, 0);
+            emit('a', id, size);
+        }
+        sizes[id] = size;
+        live[num_live++] = id;
+    }
+    free_all();
+    free(sizes);
+}
+
+/* realloc - grow one block step by step while short-lived blocks come and go */
+static void grow(int n, int start, int step, int small)
+{
+    int i, big, prev;
+
+    big = alloc(start);
+    prev = alloc(small);
+    for (i = 1; i < n; i++) {
+        emit('r', big, start + i*step);
+        alloc(small);
+        emit('f', prev, 0);
+        prev = live[num_live - 1];
+        live[num_live - 2] = prev;
+        num_live--;
+    }
+    free_all();
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: tracegen [-s seed] [-n count] <pattern>\n");
+    fprintf(stderr, "patterns: amptjp cccp cp-decl expr coalescing random random2\n");
+    fprintf(stderr, "          binary binary2 realloc realloc2 small large huge batch api tail\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int c, i, n = 0;
+    unsigned seed = 1;
+    char *pattern;
+
+    while ((c = getopt(argc, argv, "s:n:")) != EOF) {
+        switch (c) {
+        case 's':
+            seed = atoi(optarg);
+            break;
+        case 'n':
+            n = atoi(optarg);
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind != argc - 1)
+        usage();
+    pattern = argv[optind];
+
+    ops = malloc(MAXOPS * sizeof(op_t));
+    live = malloc(MAXOPS * sizeof(int));
+    if (!ops || !live) {
+        fprintf(stderr, "tracegen: out of memory\n");
+        exit(1);
+    }
+    srand(seed);
+
+    if (!strcmp(pattern, "amptjp"))
+        program(n ? n : 1000, 60, 35);
+    else if (!strcmp(pattern, "cccp"))
+        program(n ? n : 1000, 75, 22);
+    else if (!strcmp(pattern, "cp-decl"))
+        program(n ? n : 1200, 70, 25);
+    else if (!strcmp(pattern, "expr"))
+        program(n ? n : 1200, 85, 14);
+    else if (!strcmp(pattern, "coalescing"))
+        coalescing(n ? n : 2400);
+    else if (!strcmp(pattern, "random"))
+        random_sizes(n ? n : 2400, 32768);
+    else if (!strcmp(pattern, "random2"))
+        random_sizes(n ? n : 2400, 16384);
+    else if (!strcmp(pattern, "binary"))
+        binary(n ? n : 2000, 64, 448);
+    else if (!strcmp(pattern, "binary2"))
+        binary(n ? n : 4000, 16, 112);
+    else if (!strcmp(pattern, "realloc"))
+        grow(n ? n : 4800, 512, 128, 128);
+    else if (!strcmp(pattern, "realloc2"))
+        grow(n ? n : 4800, 4092, 5, 16);
+    else if (!strcmp(pattern, "small"))
+        small(n ? n : 20000);
+    else if (!strcmp(pattern, "large"))
+        large(n ? n : 1200);
+    else if (!strcmp(pattern, "huge"))
+        huge(n ? n : 600);
+    else if (!strcmp(pattern, "batch"))
+        batch(n ? n : 20000);
+    else if (!strcmp(pattern, "api"))
+        api(n ? n : 8000);
+    else if (!strcmp(pattern, "tail"))
+        tail(n ? n : 2000);
+    else
+        usage();
+
+    printf("%d\n%d\n%d\n1\n", heap_hint, num_ids, num_ops);
+    for (i = 0; i < num_ops; i++) {
+        if (ops[i].type == 'f' || ops[i].type == 'b' || ops[i].type == 'm')
+            printf("%c %d\n", ops[i].type, ops[i].id);
+        else
+            printf("%c %d %d\n", ops[i].type, ops[i].id, ops[i].size);
+    }
+    return 0;
+}
@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+#
+# keybench.py - cache key normalization and Vary handling through the proxy
+#
+# Serves resources from a local origin, half of them negotiated on
+# Accept-Language (Vary: Accept-Language, body names the language).
+# Requests each resource several times under differently spelled but
+# equivalent URLs (host case, default port, query order, escaped
+# unreserved characters, fragments) with a random Accept-Language, and
+# reports origin fetches, duplicate objects and wrongly served variants.
+#
+# usage: ./keybench.py <proxy port> [-o origin port] [-n resources] [-r rounds] [-c]
+#   -c  always use the canonical spelling, to check Vary on its own
+#
+import argparse
+import random
+import socket
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+LANGS = ["en", "de", "fr"]
+origin_fetches = 0
+
+
+class Origin(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.0"
+
+    def do_GET(self):
+        global origin_fetches
+        origin_fetches += 1
+        path = self.path.split("?")[0]
+        negotiated = int(path.rsplit("/", 1)[-1]) % 2 == 0
+        body = path
+        if negotiated:
+            body += " lang=" + self.headers.get("Accept-Language", "none")
+        body = body.encode()
+        self.send_response(200)
+        self.send_header("Content-Type", "text/plain")
+        if negotiated:
+            self.send_header("Vary", "Accept-Language")
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def log_message(self, *args):
+        pass
+
+
+def spelling(i, port, rnd, canonical):
+    """one of many equivalent URLs for resource i"""
+    if canonical:
+        return "http://localhost:%d/res/%d?a=1&b=2&c=3" % (port, i)
+    host = "".join(c.upper() if rnd.random() < 0.5 else c for c in "localhost")
+    params = ["a=1", "b=2", "c=3"]
+    rnd.shuffle(params)
+    if rnd.random() < 0.3:
+        params.insert(1, "")
+    path = "/res/%d" % i
+    if rnd.random() < 0.5:
+        path = path.replace("r", "%72", 1)
+    url = "http://%s:%d%s?%s" % (host, port, path, "&".join(params))
+    if rnd.random() < 0.3:
+        url += "#top"
+    return url
+
+
+def fetch(proxy_port, uri, headers):
+    s = socket.create_connection(("127.0.0.1", proxy_port))
+    req = "GET %s HTTP/1.0\r\n" % uri
+    for k, v in headers.items():
+        req += "%s: %s\r\n" % (k, v)
+    s.sendall((req + "\r\n").encode())
+    data = b""
+    while True:
+        chunk = s.recv(65536)
+        if not chunk:
+            break
+        data += chunk
+    s.close()
+    return data.split(b"\r\n\r\n", 1)[-1].decode(errors="replace")
+
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument("proxy_port", type=int)
+    ap.add_argument("-o", "--origin-port", type=int, default=18192)
+    ap.add_argument("-n", "--resources", type=int, default=50)
+    ap.add_argument("-r", "--rounds", type=int, default=8)
+    ap.add_argument("-c", "--canonical", action="store_true")
+    args = ap.parse_args()
+    rnd = random.Random(1)
+
+    origin = ThreadingHTTPServer(("127.0.0.1", args.origin_port), Origin)
+    threading.Thread(target=origin.serve_forever, daemon=True).start()
+
+    wrong = requests = 0
+    distinct = set()    # (resource, language) pairs the origin must serve
+    for _ in range(args.rounds):
+        for i in range(args.resources):
+            lang = rnd.choice(LANGS)
+            body = fetch(args.proxy_port, spelling(i, args.origin_port, rnd, args.canonical),
+                         {"Accept-Language": lang})
+            requests += 1
+            distinct.add((i, lang if i % 2 == 0 else None))
+            time.sleep(0.025)   # stay under the proxy's per-client rate
+            if i % 2 == 0 and not body.endswith("lang=" + lang):
+                wrong += 1
+    origin.shutdown()
+
+    needed = len(distinct)
+    print("requests %d, origin fetches %d, needed %d, duplicate objects %d, hit ratio %.2f"
+          % (requests, origin_fetches, needed, max(0, origin_fetches - needed),
+             1 - origin_fetches / requests))
+    print("wrong variants served %d" % wrong)
+
+
+if __name__ == "__main__":
+    main()
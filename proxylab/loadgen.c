@@ -0,0 +1,190 @@
+/*
+ * loadgen.c - overload benchmark for the proxy
+ *
+ * Well-behaved clients fetch a URL through the proxy at a steady pace,
+ * each from its own 127.0.1.x address, while flooders hammer it as fast
+ * as they can from one more loopback address. Reports goodput and latency of the
+ * well-behaved clients and how many flood requests were shed.
+ *
+ * usage: ./loadgen -p <proxy port> -u <url> [-w clients] [-i interval ms]
+ *                  [-f flooders] [-F flooder addr] [-d seconds]
+ */
+#include "csapp.h"
+
+#define MAX_SAMPLES 100000
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+
+typedef struct {
+  char src[INET_ADDRSTRLEN];  /* local address to connect from */
+  long ok;                    /* 200 responses */
+  long rejected;              /* 503 responses */
+  long failed;                /* anything else, including connect errors */
+  int nsamples;
+  double *latency;            /* ms, well-behaved clients only */
+} client_stats;
+
+static char *proxy_port;
+static char *url;
+static char host[MAXLINE];
+static int interval_ms = 20;
+static char *flood_addr = "127.0.0.2";
+static double deadline;
+
+static double now(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* connect to the proxy, optionally from a chosen local address */
+static int connect_proxy(const char *src) {
+  struct sockaddr_in addr;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+  if (fd < 0) return -1;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  if (src) {
+    inet_pton(AF_INET, src, &addr.sin_addr);
+    if (bind(fd, (SA *)&addr, sizeof(addr)) < 0) {
+      close(fd);
+      return -1;
+    }
+  }
+  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+  addr.sin_port = htons(atoi(proxy_port));
+  if (connect(fd, (SA *)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* issue one request, returns the HTTP status or -1 */
+static int fetch(const char *src) {
+  char buf[MAXBUF];
+  char status_line[16];
+  int fd, status = -1;
+  ssize_t n, total = 0;
+
+  if ((fd = connect_proxy(src)) < 0) return -1;
+  n = snprintf(buf, sizeof(buf), "GET %s HTTP/1.0\r\nHost: %s\r\n\r\n", url, host);
+  if (rio_writen(fd, buf, n) != n) {
+    close(fd);
+    return -1;
+  }
+  while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    if (total < sizeof(status_line) - 1)
+      memcpy(status_line + total, buf, MIN(n, sizeof(status_line) - 1 - total));
+    total += n;
+  }
+  if (total >= 12) {
+    status_line[12] = '\0';
+    sscanf(status_line + 9, "%3d", &status);
+  }
+  close(fd);
+  return status;
+}
+
+static void count(client_stats *st, int status) {
+  if (status == 200) st->ok++;
+  else if (status == 503) st->rejected++;
+  else st->failed++;
+}
+
+static void *well_behaved(void *vargp) {
+  client_stats *st = vargp;
+  double t0;
+  int status;
+
+  while ((t0 = now()) < deadline) {
+    status = fetch(st->src);
+    count(st, status);
+    if (status == 200 && st->nsamples < MAX_SAMPLES)
+      st->latency[st->nsamples++] = (now() - t0) * 1e3;
+    usleep(interval_ms * 1000);
+  }
+  return NULL;
+}
+
+static void *flooder(void *vargp) {
+  client_stats *st = vargp;
+
+  while (now() < deadline)
+    count(st, fetch(st->src));
+  return NULL;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+  int nwell = 4, nflood = 8, duration = 5;
+  int c, i, n;
+  pthread_t *tids;
+  client_stats *stats, well = {0}, flood = {0};
+  double *all, start, secs;
+  char *p;
+
+  while ((c = getopt(argc, argv, "p:u:w:i:f:F:d:")) != -1) {
+    switch (c) {
+    case 'p': proxy_port = optarg; break;
+    case 'u': url = optarg; break;
+    case 'w': nwell = atoi(optarg); break;
+    case 'i': interval_ms = atoi(optarg); break;
+    case 'f': nflood = atoi(optarg); break;
+    case 'F': flood_addr = optarg; break;
+    case 'd': duration = atoi(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s -p <proxy port> -u <url> [-w clients] [-i ms] "
+              "[-f flooders] [-F addr] [-d seconds]\n", argv[0]);
+      exit(1);
+    }
+  }
+  if (!proxy_port || !url || strncmp(url, "http://", 7)) {
+    fprintf(stderr, "need -p <proxy port> and -u http://host/path\n");
+    exit(1);
+  }
+  strcpy(host, url + 7);
+  if ((p = strchr(host, '/'))) *p = '\0';
+  Signal(SIGPIPE, SIG_IGN);
+
+  tids = Malloc((nwell + nflood) * sizeof(pthread_t));
+  stats = Calloc(nwell + nflood, sizeof(client_stats));
+  start = now();
+  deadline = start + duration;
+  for (i = 0; i < nwell + nflood; i++) {
+    stats[i].latency = i < nwell ? Malloc(MAX_SAMPLES * sizeof(double)) : NULL;
+    if (i < nwell) sprintf(stats[i].src, "127.0.1.%d", i + 1);
+    else strcpy(stats[i].src, flood_addr);
+    Pthread_create(&tids[i], NULL, i < nwell ? well_behaved : flooder, &stats[i]);
+  }
+  for (i = 0; i < nwell + nflood; i++)
+    Pthread_join(tids[i], NULL);
+  secs = now() - start;
+
+  all = Malloc(nwell * MAX_SAMPLES * sizeof(double));
+  for (i = 0, n = 0; i < nwell + nflood; i++) {
+    client_stats *sum = i < nwell ? &well : &flood;
+    sum->ok += stats[i].ok;
+    sum->rejected += stats[i].rejected;
+    sum->failed += stats[i].failed;
+    if (i < nwell) {
+      memcpy(all + n, stats[i].latency, stats[i].nsamples * sizeof(double));
+      n += stats[i].nsamples;
+    }
+  }
+  qsort(all, n, sizeof(double), cmp_double);
+
+  printf("well-behaved: %d clients, %.1f req/s goodput, %ld ok, %ld rejected, %ld failed\n",
+         nwell, well.ok / secs, well.ok, well.rejected, well.failed);
+  if (n)
+    printf("  latency ms: p50 %.2f  p99 %.2f  max %.2f\n",
+           all[n / 2], all[(int)(n * 0.99)], all[n - 1]);
+  printf("flooders:     %d threads, %ld ok, %ld rejected, %ld failed (%.0f req/s offered)\n",
+         nflood, flood.ok, flood.rejected, flood.failed,
+         (flood.ok + flood.rejected + flood.failed) / secs);
+  return 0;
+}
@@ -0,0 +1,82 @@
+/*
+ * memwatch.c - read memory pressure from PSI and the cgroup v2 limits
+ *
+ * mem_pressure() reports the worse of two signals: the "some avg10"
+ * stall percentage from a PSI file (/proc/pressure/memory, or any file
+ * in the same format, which is how a pressure source is simulated) and
+ * memory.current against memory.max of our cgroup.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "memwatch.h"
+
+#define PSI_PATH        "/proc/pressure/memory"
+#define CGROUP_CURRENT  "/sys/fs/cgroup/memory.current"
+#define CGROUP_MAX      "/sys/fs/cgroup/memory.max"
+#define PSI_SOME        1.0     /* avg10 stall % that counts as pressure */
+#define PSI_HIGH        10.0
+#define CGROUP_SOME     75      /* memory.current as % of memory.max */
+#define CGROUP_HIGH     90
+
+static int read_psi(const char *path);
+static int read_cgroup(size_t *current, size_t *max);
+
+/* current pressure level, PRESSURE_UNKNOWN if nothing can be read */
+int mem_pressure(const char *psi_path) {
+  size_t current, max;
+  int level = read_psi(psi_path ? psi_path : PSI_PATH);
+  int cg = PRESSURE_UNKNOWN;
+
+  if (read_cgroup(&current, &max) == 0) {
+    if (current * 100 >= max * CGROUP_HIGH) cg = PRESSURE_HIGH;
+    else if (current * 100 >= max * CGROUP_SOME) cg = PRESSURE_SOME;
+    else cg = PRESSURE_NONE;
+  }
+  return cg > level ? cg : level;
+}
+
+/* bytes that can still be used: MemAvailable, capped by the cgroup limit */
+size_t mem_headroom(void) {
+  char line[256];
+  size_t kb = 0, current, max;
+  FILE *fp;
+
+  if ((fp = fopen("/proc/meminfo", "r"))) {
+    while (fgets(line, sizeof(line), fp)) {
+      if (sscanf(line, "MemAvailable: %zu kB", &kb) == 1) break;
+    }
+    fclose(fp);
+  }
+  if (read_cgroup(&current, &max) == 0 && max - current < kb * 1024) {
+    return current < max ? max - current : 0;
+  }
+  return kb * 1024;
+}
+
+static int read_psi(const char *path) {
+  FILE *fp = fopen(path, "r");
+  float avg10;
+  int n;
+
+  if (!fp) return PRESSURE_UNKNOWN;
+  n = fscanf(fp, "some avg10=%f", &avg10);
+  fclose(fp);
+  if (n != 1) return PRESSURE_UNKNOWN;
+  if (avg10 >= PSI_HIGH) return PRESSURE_HIGH;
+  if (avg10 >= PSI_SOME) return PRESSURE_SOME;
+  return PRESSURE_NONE;
+}
+
+/* returns -1 unless the cgroup has a memory limit */
+static int read_cgroup(size_t *current, size_t *max) {
+  FILE *fp;
+  int n;
+
+  if (!(fp = fopen(CGROUP_MAX, "r"))) return -1;
+  n = fscanf(fp, "%zu", max);             /* "max" means unlimited */
+  fclose(fp);
+  if (n != 1 || !(fp = fopen(CGROUP_CURRENT, "r"))) return -1;
+  n = fscanf(fp, "%zu", current);
+  fclose(fp);
+  return n == 1 ? 0 : -1;
+}
@@ -0,0 +1,18 @@
+/*
+ * memwatch.h - memory pressure and headroom readings for cache sizing
+ */
+#ifndef __MEMWATCH_H__
+#define __MEMWATCH_H__
+
+#include <stddef.h>
+
+/* pressure levels returned by mem_pressure() */
+#define PRESSURE_UNKNOWN  -1
+#define PRESSURE_NONE      0
+#define PRESSURE_SOME      1
+#define PRESSURE_HIGH      2
+
+int mem_pressure(const char *psi_path);
+size_t mem_headroom(void);
+
+#endif /* __MEMWATCH_H__ */
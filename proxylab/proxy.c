@@ -1,10 +1,37 @@
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
 #include "csapp.h"
+#include "slab.h"
+#include "sbuf.h"
+#include "ratelimit.h"
+#include "memwatch.h"
 
-/* Recommended max cache and object sizes */
+/* Recommended max cache and object sizes, defaults for -c and -o */
 #define MAX_CACHE_SIZE 1049000
 #define MAX_OBJECT_SIZE 102400
+#define CACHE_BUCKETS 1024      /* cache key hash table size, a power of two */
+#define MAX_VARIANTS 8          /* stored variants per cache key */
+
+/* Adaptive cache sizing (-a) */
+#define ADAPT_INTERVAL 1        /* seconds between adjustments */
+#define ADAPT_RANGE 16          /* cache may move between size/16 and size*16 */
+#define OBJECT_RATIO 10         /* objects are at most 1/10 of the cache */
+#define HIT_RATIO_TARGET 0.9    /* stop growing once this hit ratio is met */
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+
+/* Admission control */
+#define NTHREADS 16             /* worker threads, the concurrency cap */
+#define SBUF_SIZE 64            /* accepted connections waiting for a worker */
+#define CLIENT_RATE 50          /* connections per second per client address */
+#define CLIENT_BURST 100        /* connections a client may open at once */
+#define CLIENT_TIMEOUT 5        /* seconds a client may stay silent or stop reading */
+
+/* Link prefetching (-p) */
+#define PREFETCH_THREADS 2      /* background fetchers */
+#define PREFETCH_QUEUE 64       /* pending prefetches, further links are dropped */
+#define PREFETCH_PER_PAGE 16    /* links taken from a single page */
 
 /* Request, Header, CachedItem struct declaration */
 typedef struct
@@ -18,121 +45,345 @@ typedef struct
 
 typedef struct RequestHeader
 {
-  char name[MAXLINE];
-  char data[MAXLINE];
+  char* name;
+  char* data;
   struct RequestHeader* next;
+  char buf[];             /* name and data are stored inline */
 } RequestHeader;
 
+/* one stored response; responses for the same URL hang off one CacheKey */
 typedef struct CachedItem
 {
-  char hostname[200];
-  char path[1000];
+  struct CacheKey* key;
+  char* vary;             /* "name: value\n" of each header the response Varies on */
   size_t size;
   char* data;
-  struct CachedItem* next;
+  struct CachedItem* next;      /* list of all items, scanned by LRU() */
+  struct CachedItem* variant;   /* next variant of the same key */
   clock_t access_time;
+  size_t footprint;       /* slab bytes charged to cache_volume */
+  int pins;               /* clients writing data out without cache_mutex */
+  char buf[];             /* vary and data are stored inline */
 } CachedItem;
 
+typedef struct CacheKey
+{
+  uint64_t hash;          /* hash of the canonical URL */
+  struct CacheKey* next;  /* hash bucket chain */
+  CachedItem* variants;
+  int nvariants;
+  size_t footprint;
+  char url[];             /* canonical URL */
+} CacheKey;
+
+typedef struct
+{
+  char hostname[200];
+  char path[1000];
+} PrefetchItem;
+
 
 /* Global and static variables */
 CachedItem* root_cache;
 int cache_volume = 0;
+static CacheKey* cache_index[CACHE_BUCKETS];
+static int cache_keys = 0, cache_items = 0;
+static sem_t cache_mutex;
+
+/* cache limits, set by -c/-o and moved by the adapt thread under cache_mutex */
+static size_t max_cache_size = MAX_CACHE_SIZE;
+static size_t max_object_size = MAX_OBJECT_SIZE;
+static size_t cache_size_floor, cache_size_ceiling, object_size_ceiling;
+static int adapt_enabled = 0;
+static double hit_ratio_target = HIT_RATIO_TARGET;
+static char *pressure_path = NULL;      /* PSI-format file, -m */
+static int pressure_level = PRESSURE_UNKNOWN;
+static double last_hit_ratio = 0;
+static sbuf_t sbuf;
+
+/* prefetch queue, a bounded ring like sbuf */
+static int prefetch_enabled = 0;
+static PrefetchItem prefetch_queue[PREFETCH_QUEUE];
+static int prefetch_front = 0, prefetch_rear = 0;
+static sem_t prefetch_mutex, prefetch_slots, prefetch_items;
+
+/* counters reported on GET /stats */
+static volatile long stat_hits = 0;
+static volatile long stat_misses = 0;
+static volatile long stat_prefetched = 0;
+static volatile long stat_prefetch_dropped = 0;
+static volatile long stat_evictions = 0;
+static const char *overload_response = "HTTP/1.0 503 Service Unavailable\r\n"
+  "Retry-After: 1\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
 static const char *user_agent_hdr = "Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 Firefox/10.0.3";
 
 /* Helper functions */
-static RequestHeader *root_header = NULL;
+static __thread RequestHeader *root_header = NULL;
 void *thread_handler(void*);
-void client_handler(int, Request*);
+void reject_client(int);
+int client_handler(int, Request*);
 void server_handler(int, Request*);
 
 void parse_request(Request *, char*);
 void parse_header(char*);
 
+RequestHeader* new_header(const char*, size_t, const char*, size_t);
 void insert_header(RequestHeader*);
 RequestHeader* get_last_header();
 RequestHeader* get_header_by_key(char*);
-void init_header(Request*);
+int init_header(Request*);
 void free_req_and_header(Request*, RequestHeader*);
 
 void send_request(int, Request*, RequestHeader* header_host);
+void send_stats(int);
+
+void *prefetch_handler(void*);
+void prefetch_init();
+void prefetch_insert(char*, char*);
+void prefetch_links(char*, size_t, char*, char*);
 
 char* safe_strncpy(char *, const char*, size_t);
 
 void init_cache();
+void set_cache_limit(size_t);
+void *adapt_handler(void*);
+void cache_key(char*, size_t, Request*, RequestHeader*);
+uint64_t hash_key(char*);
+CachedItem* search_cache(char*);
+int response_vary(char*, size_t, char*, size_t);
+CachedItem* create_cache(char*, char*, size_t);
+void insert_cache(CachedItem*, char*);
 void delete_cache(CachedItem*);
+void unpin_cache(CachedItem*);
 void update_time(CachedItem*);
 
 int main(int argc, char **argv) {
   char *port;
-  int listenfd, *connfd;
+  int listenfd, connfd, i;
   socklen_t clientlen;
   struct sockaddr_in clientaddr;
   pthread_t tid;
 
-  if (argc != 2) {
-    printf("Argument error, ex: ./proxy <port_number>\n");
+  while ((i = getopt(argc, argv, "pc:o:at:m:")) != -1) {
+    switch (i) {
+    case 'p': prefetch_enabled = 1; break;
+    case 'c': max_cache_size = strtoul(optarg, NULL, 10); break;
+    case 'o': max_object_size = strtoul(optarg, NULL, 10); break;
+    case 'a': adapt_enabled = 1; break;
+    case 't': hit_ratio_target = atof(optarg); break;
+    case 'm': pressure_path = optarg; break;
+    default: optind = argc; break;
+    }
   }
-  root_cache = malloc(sizeof(CachedItem));
+  if (optind != argc - 1 || !max_cache_size || !max_object_size) {
+    printf("Argument error, ex: ./proxy [-p] [-c cache_bytes] [-o object_bytes] "
+           "[-a [-t hit_ratio] [-m psi_file]] <port_number>\n");
+    exit(1);
+  }
+  cache_size_floor = max_cache_size / ADAPT_RANGE;
+  cache_size_ceiling = max_cache_size * ADAPT_RANGE;
+  object_size_ceiling = max_object_size;
+  slab_init();
+  if (!(root_cache = slab_calloc(sizeof(CachedItem)))) app_error("out of memory");
   init_cache();
-  port  = argv[1];
+  port  = argv[optind];
+  Signal(SIGPIPE, SIG_IGN);
   listenfd = Open_listenfd(port);
 
+  sbuf_init(&sbuf, SBUF_SIZE);
+  rate_init(CLIENT_RATE, CLIENT_BURST);
+  for (i = 0; i < NTHREADS; i++) {
+    Pthread_create(&tid, NULL, thread_handler, NULL);
+  }
+  if (prefetch_enabled) {
+    prefetch_init();
+  }
+  if (adapt_enabled) {
+    set_cache_limit(max_cache_size);
+    Pthread_create(&tid, NULL, adapt_handler, NULL);
+  }
+
   while(1) {
     clientlen = sizeof(clientaddr);
-    connfd = Malloc(sizeof(int));
-    *connfd = Accept(listenfd, (SA *)&clientaddr, &clientlen);
-    Pthread_create(&tid, NULL, thread_handler, connfd);
+    if ((connfd = accept(listenfd, (SA *)&clientaddr, &clientlen)) < 0) continue;
+    /* over its rate, or every worker busy and the queue full: shed now */
+    if (!rate_admit(clientaddr.sin_addr.s_addr) || sbuf_tryinsert(&sbuf, connfd) < 0) {
+      reject_client(connfd);
+    }
   }
   return 0;
 }
 
 /* initialize cache */
 void init_cache() {
-  strcpy(root_cache->hostname, "");
-  strcpy(root_cache->path, "");
+  Sem_init(&cache_mutex, 0, 1);
+  root_cache->key = NULL;
+  root_cache->vary = "";
   root_cache->size= 0;
   root_cache->data= NULL;
   root_cache->next = NULL;
   root_cache->access_time= clock();
+  root_cache->footprint = 0;
+  root_cache->pins = 0;
 }
 
-/* function for each thread */
+/* function for each worker thread */
 void *thread_handler(void* vargp) {    
+  struct timeval timeout = { CLIENT_TIMEOUT, 0 };
   Pthread_detach(pthread_self());
-  int clientfd = *((int*)vargp);
-  free(vargp);
-  Request* req = Malloc(sizeof(Request));
-  client_handler(clientfd, req);
-  server_handler(clientfd, req);
+  while (1) {
+    int clientfd = sbuf_remove(&sbuf);
+    setsockopt(clientfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(clientfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    Request* req = slab_calloc(sizeof(Request));
+    if (!req) {
+      reject_client(clientfd);
+      continue;
+    }
+    if (client_handler(clientfd, req) == 0) {
+      server_handler(clientfd, req);
+    } else {
+      Close(clientfd);
+    }
+    free_req_and_header(req, root_header);
+    root_header = NULL;
+  }
   return NULL;
 }
 
-/* handle interaction with client */
-void client_handler(int clientfd, Request* req) {
+/* answer 503 without blocking the accept loop and drop the connection */
+void reject_client(int clientfd) {
+  send(clientfd, overload_response, strlen(overload_response), MSG_DONTWAIT | MSG_NOSIGNAL);
+  Close(clientfd);
+}
+
+/* handle interaction with client, returns -1 if it went away or memory ran out */
+int client_handler(int clientfd, Request* req) {
     rio_t rio;
     char buf[MAXLINE];
 
     Rio_readinitb(&rio, clientfd);
-    Rio_readlineb(&rio, buf, MAXLINE);
+    if (rio_readlineb(&rio, buf, MAXLINE) <= 0) return -1;
     parse_request(req, buf);
     memset(&buf[0], 0, sizeof(buf)); 
 
-    Rio_readlineb(&rio, buf, MAXLINE);
+    if (rio_readlineb(&rio, buf, MAXLINE) <= 0) return -1;
     while (strcmp(buf, "\r\n")) {
         parse_header(buf);
         memset(&buf[0], 0, sizeof(buf)); 
-        Rio_readlineb(&rio, buf, MAXLINE);
+        if (rio_readlineb(&rio, buf, MAXLINE) <= 0) return -1;
     }
     memset(&buf[0], 0, sizeof(buf));
-    init_header(req);
+    return init_header(req);
 }
 
-/* search for cached request */
-CachedItem* search_cache(char path[], char hostname[]) {
-  CachedItem* temp = root_cache;
-  while(temp!= NULL) {
-    if((strcmp(path, temp-> path) == 0) && (strcmp(hostname, temp-> hostname) == 0)) return temp;
-    temp = temp->next;
+/* qsort comparator for query parameters */
+static int cmp_param(const void* a, const void* b) {
+  return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/*
+ * build the canonical cache key of a request: lower-case host without
+ * the default port, path with unreserved %XX escapes decoded and the
+ * rest in upper case, query parameters sorted, fragment dropped
+ */
+void cache_key(char* key, size_t size, Request* req, RequestHeader* header_host) {
+  char url[MAXLINE];
+  char* params[256];
+  char* host = strlen(req->hostname) ? req->hostname : header_host->data;
+  char* src = req->path;
+  char* dst = url;
+  char* query = NULL;
+  int nparams = 0, i;
+
+  /* host */
+  for (; *host && dst < url + 256; host++) *dst++ = tolower((unsigned char)*host);
+  if (dst - url > 3 && strncmp(dst - 3, ":80", 3) == 0) dst -= 3;
+
+  /* path and query, with escapes normalized */
+  for (; *src && *src != '#' && dst < url + sizeof(url) - 4; src++) {
+    if (src[0] == '%' && isxdigit((unsigned char)src[1]) && isxdigit((unsigned char)src[2])) {
+      char hex[3] = { src[1], src[2], 0 };
+      int c = strtol(hex, NULL, 16);
+      if (isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~') {
+        *dst++ = c;
+      } else {
+        *dst++ = '%';
+        *dst++ = toupper((unsigned char)src[1]);
+        *dst++ = toupper((unsigned char)src[2]);
+      }
+      src += 2;
+    } else if (*src == '?' && !query) {
+      *dst++ = '\0';
+      query = dst;
+    } else {
+      *dst++ = *src;
+    }
+  }
+  *dst = '\0';
+
+  if (query) {
+    char* p = query;
+    while (p && nparams < 256) {
+      char* amp = strchr(p, '&');
+      if (amp) *amp = '\0';
+      if (*p) params[nparams++] = p;
+      p = amp ? amp + 1 : NULL;
+    }
+    qsort(params, nparams, sizeof(char*), cmp_param);
+  }
+  snprintf(key, size, "%s", url);
+  for (i = 0; i < nparams; i++) {
+    strncat(key, i ? "&" : "?", size - strlen(key) - 1);
+    strncat(key, params[i], size - strlen(key) - 1);
+  }
+}
+
+/* 64-bit FNV-1a hash of a canonical key */
+uint64_t hash_key(char* key) {
+  uint64_t h = 14695981039346656037ULL;
+  for (; *key; key++) {
+    h ^= (unsigned char)*key;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+/* does the current request carry the header values a variant was stored for */
+static int vary_matches(char* vary) {
+  char name[MAXLINE];
+  char* line = vary;
+
+  while (*line) {
+    char* colon = strchr(line, ':');
+    char* eol = strchr(line, '\n');
+    RequestHeader* header;
+    size_t len;
+
+    safe_strncpy(name, line, colon - line);
+    header = get_header_by_key(name);
+    len = eol - colon - 2;
+    if (header ? (strlen(header->data) != len || strncmp(header->data, colon + 2, len))
+               : len != 0) {
+      return 0;
+    }
+    line = eol + 1;
+  }
+  return 1;
+}
+
+/* search for cached request by canonical key and Vary headers, cache_mutex held */
+CachedItem* search_cache(char* key) {
+  uint64_t hash = hash_key(key);
+  CacheKey* k;
+  CachedItem* temp;
+
+  for (k = cache_index[hash & (CACHE_BUCKETS - 1)]; k; k = k->next) {
+    if (k->hash == hash && strcmp(k->url, key) == 0) break;
+  }
+  if (!k) return NULL;
+  for (temp = k->variants; temp; temp = temp->variant) {
+    if (vary_matches(temp->vary)) return temp;
   }
   return NULL;
 }
@@ -140,28 +391,132 @@ CachedItem* search_cache(char path[], char hostname[]) {
 /* handle interaction with server */
 void server_handler(int clientfd, Request* req) {
     RequestHeader* header_host;
+    if (!strlen(req->hostname) && strcmp(req->uri, "/stats") == 0) {
+      send_stats(clientfd);
+      return;
+    }
+    char key[MAXLINE];
     header_host= get_header_by_key("Host");
-    CachedItem* target = search_cache(req->path, header_host->data);
+    cache_key(key, sizeof(key), req, header_host);
+    P(&cache_mutex);
+    CachedItem* target = search_cache(key);
     if (target) {
-      Rio_writen(clientfd, target->data, target->size);
+      /* pin the item and write it out unlocked, so a slow client does
+         not stall every other thread; an eviction meanwhile only unlinks it */
+      target->pins++;
       update_time(target);
+      V(&cache_mutex);
+      rio_writen(clientfd, target->data, target->size);
+      P(&cache_mutex);
+      unpin_cache(target);
+      V(&cache_mutex);
+      __sync_fetch_and_add(&stat_hits, 1);
       Close(clientfd);
       return;
     }
+    V(&cache_mutex);
+    __sync_fetch_and_add(&stat_misses, 1);
     send_request(clientfd, req, header_host);
 }
 
-/* initialize new CachedItem and insert to list */
-CachedItem* create_cache() {
-  CachedItem* temp = root_cache;
+/*
+ * collect the request's values of the headers a response Varies on as
+ * "name: value\n" lines; returns -1 if the response must not be cached
+ */
+int response_vary(char* buf, size_t size, char* vary, size_t vary_size) {
+  char* end = buf + size;
+  char* line;
+  char name[MAXLINE];
+
+  vary[0] = '\0';
+  for (line = buf; line + 7 < end && memcmp(line, "\r\n\r\n", 4); line++) {
+    char* p;
+    if (strncasecmp(line, "\r\nVary:", 7) != 0) continue;
+    for (p = line + 7; p < end && *p != '\r';) {
+      size_t len = 0;
+      RequestHeader* header;
+      while (p < end && (*p == ' ' || *p == ',')) p++;
+      while (p + len < end && p[len] != ',' && p[len] != ' ' && p[len] != '\r') len++;
+      if (len == 0 || len >= sizeof(name)) break;
+      if (*p == '*') return -1;
+      safe_strncpy(name, p, len);
+      header = get_header_by_key(name);
+      if (strlen(vary) + len + (header ? strlen(header->data) : 0) + 4 >= vary_size) return -1;
+      strcat(vary, name);
+      strcat(vary, ": ");
+      if (header) strcat(vary, header->data);
+      strcat(vary, "\n");
+      p += len;
+    }
+  }
+  return 0;
+}
+
+/* build a CachedItem with vary values and data inline in one slab object */
+CachedItem* create_cache(char* vary, char* data, size_t size) {
+  size_t vary_len = strlen(vary);
   CachedItem* target;
+
+  target = slab_alloc(sizeof(CachedItem) + vary_len + 1 + size);
+  if (!target) return NULL;
+  target->vary = target->buf;
+  target->data = target->vary + vary_len + 1;
+  memcpy(target->vary, vary, vary_len + 1);
+  memcpy(target->data, data, size);
+  target->size = size;
+  target->key = NULL;
+  target->next = NULL;
+  target->variant = NULL;
+  target->footprint = slab_usable_size(target);
+  target->pins = 0;
+  return target;
+}
+
+/* link a CachedItem under its key and at the end of the list, cache_mutex held */
+void insert_cache(CachedItem* target, char* key) {
+  uint64_t hash = hash_key(key);
+  CacheKey** bucket = &cache_index[hash & (CACHE_BUCKETS - 1)];
+  CachedItem* temp = root_cache;
+  CacheKey* k;
+
+  for (k = *bucket; k; k = k->next) {
+    if (k->hash == hash && strcmp(k->url, key) == 0) break;
+  }
+  if (!k) {
+    if (!(k = slab_alloc(sizeof(CacheKey) + strlen(key) + 1))) {
+      slab_free(target);
+      return;
+    }
+    k->hash = hash;
+    k->variants = NULL;
+    k->nvariants = 0;
+    strcpy(k->url, key);
+    k->footprint = slab_usable_size(k);
+    k->next = *bucket;
+    *bucket = k;
+    cache_volume += k->footprint;
+    cache_keys++;
+  } else if (k->nvariants >= MAX_VARIANTS) {
+    /* too many variants: drop the least recently used one */
+    CachedItem* oldest = k->variants;
+    for (temp = k->variants; temp; temp = temp->variant) {
+      if (temp->access_time < oldest->access_time) oldest = temp;
+    }
+    delete_cache(oldest);
+    temp = root_cache;
+  }
+
+  target->key = k;
+  target->variant = k->variants;
+  k->variants = target;
+  k->nvariants++;
   while(temp -> next) {
     temp = temp->next;
   }
-  target = malloc(sizeof(CachedItem));
   temp->next = target;
-  target->next = NULL;
-  return target;
+  cache_volume += target->footprint;
+  cache_items++;
+  update_time(target);
 }
 
 /* updated cache hit time */
@@ -175,6 +530,7 @@ CachedItem* LRU() {
   CachedItem* temp = root_cache;
   temp = temp->next;
   CachedItem* eviction = temp;
+  if (!temp) return NULL;
   clock_t least = temp -> access_time;
   while (temp) {
     if (least > temp->access_time){
@@ -191,18 +547,43 @@ void delete_cache(CachedItem* eviction) {
   CachedItem* temp = root_cache;
   if (!eviction) return;
   if (!temp) return;
-  while ((temp->next != eviction) && temp){
+  while (temp && (temp->next != eviction)){
     temp = temp->next;
   }
   if (!temp) return;
   temp->next = eviction ->next;
-  cache_volume -= (eviction->size);
-  free(eviction->data);
-  free(eviction);
+  cache_volume -= (eviction->footprint);
+  cache_items--;
+  stat_evictions++;
+
+  /* unlink from its key, and drop the key with its last variant */
+  CacheKey* k = eviction->key;
+  CachedItem** pv = &k->variants;
+  while (*pv != eviction) pv = &(*pv)->variant;
+  *pv = eviction->variant;
+  if (--k->nvariants == 0) {
+    CacheKey** pk = &cache_index[k->hash & (CACHE_BUCKETS - 1)];
+    while (*pk != k) pk = &(*pk)->next;
+    *pk = k->next;
+    cache_volume -= k->footprint;
+    cache_keys--;
+    slab_free(k);
+  }
+  /* a pinned item is freed by the last client writing it out */
+  eviction->key = NULL;
+  if (eviction->pins == 0) slab_free(eviction);
   return;
 }
 
-/* send request to serverfd and get response to clientfd, update cache */
+/* drop a client's pin, freeing the item if it was evicted meanwhile, cache_mutex held */
+void unpin_cache(CachedItem* target) {
+  if (--target->pins == 0 && !target->key) slab_free(target);
+}
+
+/*
+ * send request to serverfd and get response to clientfd, update cache.
+ * clientfd is -1 for a prefetch, which only fills the cache.
+ */
 void send_request(int clientfd, Request* req, RequestHeader* header_host) {
   char* default_port="80";
   char* pport = NULL;
@@ -221,6 +602,7 @@ void send_request(int clientfd, Request* req, RequestHeader* header_host) {
   }
   else {
     printf("error occur: host not found\n");
+    if (clientfd >= 0) Close(clientfd);
     return;
   }
   pport = strstr(Request_domain, ":");
@@ -232,6 +614,7 @@ void send_request(int clientfd, Request* req, RequestHeader* header_host) {
     strcpy(Request_port, default_port);
   }
 
+  Request_buf[0] = '\0';
   strcat(Request_buf, req->method);
   strcat(Request_buf, " ");
   strcat(Request_buf, req->path);
@@ -247,86 +630,308 @@ void send_request(int clientfd, Request* req, RequestHeader* header_host) {
   }
   strcat(Request_buf, "\r\n");
 
-  serverfd = Open_clientfd(Request_domain, Request_port);
+  if ((serverfd = open_clientfd(Request_domain, Request_port)) < 0) {
+    if (clientfd >= 0) Close(clientfd);
+    return;
+  }
   
-  Rio_writen(serverfd, Request_buf, strlen(Request_buf));
+  rio_writen(serverfd, Request_buf, strlen(Request_buf));
   rio_t rio;
   char read_buf[MAXLINE];
   ssize_t n = 0;
-  char cache_buf[MAX_OBJECT_SIZE];
+  size_t object_limit = max_object_size;
+  char *cache_buf = slab_alloc(object_limit);
   char *cache_ptr = cache_buf;
-  int cachable = 1;
+  int cachable = cache_buf != NULL;
   Rio_readinitb(&rio, serverfd);
-  while ((n = Rio_readnb(&rio, read_buf, MAXLINE)) > 0) {
-    Rio_writen(clientfd, read_buf, (size_t)n);
+  while ((n = rio_readnb(&rio, read_buf, MAXLINE)) > 0) {
+    if (clientfd >= 0 && rio_writen(clientfd, read_buf, (size_t)n) != n) {
+      cachable = 0;
+      break;
+    }
     if (cachable) {
-      if ((n+(cache_ptr - cache_buf)) <= MAX_OBJECT_SIZE){
-        safe_strncpy(cache_ptr, read_buf, n); 
+      if ((n+(cache_ptr - cache_buf)) <= object_limit){
+        memcpy(cache_ptr, read_buf, n);
         cache_ptr += n;
       } else {
         cachable = 0;
       }
     }
   }
-  if (cachable) {
-    int cache_size = cache_ptr - cache_buf;
-    if ((cache_volume + cache_size) > MAX_CACHE_SIZE){
-      while ((cache_volume + cache_size > MAX_CACHE_SIZE)){
+  if (n < 0) cachable = 0;
+  Close(serverfd);
+  if (clientfd >= 0) Close(clientfd);
+
+  CachedItem* new_cache;
+  char key[MAXLINE];
+  char vary[MAXLINE];
+  if (cachable && response_vary(cache_buf, cache_ptr - cache_buf, vary, sizeof(vary)) < 0) {
+    cachable = 0;
+  }
+  if (cachable && (new_cache = create_cache(vary, cache_buf, cache_ptr - cache_buf))) {
+    cache_key(key, sizeof(key), req, header_host);
+    P(&cache_mutex);
+    if (search_cache(key)) {
+      /* a prefetch or another client got here first */
+      V(&cache_mutex);
+      slab_free(new_cache);
+    } else {
+      while ((cache_volume + new_cache->footprint > max_cache_size)){
         CachedItem* eviction = LRU();
+        if (!eviction) break;
         delete_cache(eviction);
       }
+      insert_cache(new_cache, key);
+      V(&cache_mutex);
+    }
+    if (prefetch_enabled && clientfd >= 0) {
+      prefetch_links(cache_buf, cache_ptr - cache_buf, header_host->data, req->path);
     }
-    CachedItem* new_cache = create_cache();
-    new_cache->size = cache_size;
-    strcpy(new_cache->hostname, header_host->data);
-    strcpy(new_cache->path, req->path);
-    new_cache -> data = malloc(cache_size);
-    safe_strncpy(new_cache ->data, cache_buf, cache_size);
-    cache_volume += cache_size;
-    update_time(new_cache);
   }
-  Close(serverfd);
+  slab_free(cache_buf);
+}
+
+/* set the cache limit and evict down to it, cache_mutex held */
+void set_cache_limit(size_t size) {
+  max_cache_size = size;
+  max_object_size = MIN(object_size_ceiling, size / OBJECT_RATIO);
+  while (cache_volume > max_cache_size) {
+    CachedItem* eviction = LRU();
+    if (!eviction) break;
+    delete_cache(eviction);
+  }
+}
+
+/*
+ * adapt thread: shrink the cache by a quarter under high memory
+ * pressure; grow it by a quarter while there is no pressure, the cache
+ * is evicting, the hit ratio is below target and memory is free
+ */
+void *adapt_handler(void* vargp) {
+  long hits = 0, misses = 0, evictions = 0;
+  long dh, dm, de;
+  double ratio;
+  size_t size;
+  int level;
+
+  Pthread_detach(pthread_self());
+  while (1) {
+    sleep(ADAPT_INTERVAL);
+    dh = stat_hits - hits;
+    dm = stat_misses - misses;
+    de = stat_evictions - evictions;
+    hits += dh;
+    misses += dm;
+    evictions += de;
+    ratio = (dh + dm) ? (double)dh / (dh + dm) : last_hit_ratio;
+    level = mem_pressure(pressure_path);
+
+    size = max_cache_size;
+    if (level == PRESSURE_HIGH) {
+      size = MAX(size * 3 / 4, cache_size_floor);
+    } else if (level <= PRESSURE_NONE && de > 0 && ratio < hit_ratio_target &&
+               mem_headroom() > size) {
+      size = MIN(size * 5 / 4, cache_size_ceiling);
+    }
+
+    P(&cache_mutex);
+    pressure_level = level;
+    last_hit_ratio = ratio;
+    if (size != max_cache_size) set_cache_limit(size);
+    V(&cache_mutex);
+    if (level == PRESSURE_HIGH) slab_trim();    /* hand evicted slabs back */
+  }
+  return NULL;
+}
+
+/* report cache and prefetch counters as a plain text response */
+void send_stats(int clientfd) {
+  char body[1024], buf[MAXLINE];
+  int n;
+
+  P(&cache_mutex);
+  n = snprintf(body, sizeof(body),
+               "hits %ld\nmisses %ld\nprefetched %ld\nprefetch_dropped %ld\n"
+               "evictions %ld\nkeys %d\nobjects %d\n"
+               "cache_volume %d\nmax_cache_size %zu\nmax_object_size %zu\n"
+               "adaptive %d\nhit_ratio %.3f\nhit_ratio_target %.3f\npressure %d\n"
+               "slab_footprint %zu\n",
+               stat_hits, stat_misses, stat_prefetched, stat_prefetch_dropped,
+               stat_evictions, cache_keys, cache_items,
+               cache_volume, max_cache_size, max_object_size,
+               adapt_enabled, last_hit_ratio, hit_ratio_target, pressure_level,
+               slab_footprint());
+  V(&cache_mutex);
+  snprintf(buf, sizeof(buf), "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\n"
+           "Content-Length: %d\r\nConnection: close\r\n\r\n%s", n, body);
+  rio_writen(clientfd, buf, strlen(buf));
   Close(clientfd);
 }
 
-/* initialize header struct */
-void init_header(Request* req) {
+/* start the background fetchers */
+void prefetch_init() {
+  pthread_t tid;
+  int i;
+
+  Sem_init(&prefetch_mutex, 0, 1);
+  Sem_init(&prefetch_slots, 0, PREFETCH_QUEUE);
+  Sem_init(&prefetch_items, 0, 0);
+  for (i = 0; i < PREFETCH_THREADS; i++) {
+    Pthread_create(&tid, NULL, prefetch_handler, NULL);
+  }
+}
+
+/* queue a same-host URL for prefetching, dropped if the queue is full */
+void prefetch_insert(char* hostname, char* path) {
+  PrefetchItem* item;
+
+  if (strlen(hostname) >= sizeof(item->hostname) || strlen(path) >= sizeof(item->path)) return;
+  if (sem_trywait(&prefetch_slots) < 0) {
+    __sync_fetch_and_add(&stat_prefetch_dropped, 1);
+    return;
+  }
+  P(&prefetch_mutex);
+  item = &prefetch_queue[(++prefetch_rear) % PREFETCH_QUEUE];
+  strcpy(item->hostname, hostname);
+  strcpy(item->path, path);
+  V(&prefetch_mutex);
+  V(&prefetch_items);
+}
+
+/* background fetcher: pull queued URLs into the cache */
+void *prefetch_handler(void* vargp) {
+  PrefetchItem item;
+  RequestHeader* header_host;
+  CachedItem* target;
+  char key[MAXLINE];
+
+  Pthread_detach(pthread_self());
+  while (1) {
+    P(&prefetch_items);
+    P(&prefetch_mutex);
+    item = prefetch_queue[(++prefetch_front) % PREFETCH_QUEUE];
+    V(&prefetch_mutex);
+    V(&prefetch_slots);
+
+    Request* req = slab_calloc(sizeof(Request));
+    if (!req) continue;
+    strcpy(req->method, "GET");
+    strcpy(req->version, "HTTP/1.0");
+    strcpy(req->hostname, item.hostname);
+    strcpy(req->path, item.path);
+    if (init_header(req) < 0) {
+      free_req_and_header(req, root_header);
+      root_header = NULL;
+      continue;
+    }
+    header_host = get_header_by_key("Host");
+
+    cache_key(key, sizeof(key), req, header_host);
+    P(&cache_mutex);
+    target = search_cache(key);
+    V(&cache_mutex);
+    if (!target) {
+      send_request(-1, req, header_host);
+      __sync_fetch_and_add(&stat_prefetched, 1);
+    }
+    free_req_and_header(req, root_header);
+    root_header = NULL;
+  }
+  return NULL;
+}
+
+/*
+ * scan a cached text/html response for src= and href= links on the
+ * same host and queue up to PREFETCH_PER_PAGE of them
+ */
+void prefetch_links(char* buf, size_t size, char* hostname, char* base) {
+  char* end = buf + size;
+  char* body;
+  char* p;
+  char* type;
+  char link[1000];
+  char path[1000];
+  size_t host_len = strlen(hostname);
+  size_t dir_len;
+  int queued = 0;
+
+  for (body = buf; body + 4 <= end && memcmp(body, "\r\n\r\n", 4); body++);
+  if (body + 4 > end) return;
+  /* only text/html bodies */
+  for (type = buf; type < body; type++) {
+    if (strncasecmp(type, "\r\nContent-Type:", 15) == 0) break;
+  }
+  if (type >= body) return;
+  for (type += 15; *type == ' '; type++);
+  if (strncasecmp(type, "text/html", 9) != 0) return;
+
+  dir_len = strrchr(base, '/') ? strrchr(base, '/') - base + 1 : 0;
+  for (p = body + 4; p < end && queued < PREFETCH_PER_PAGE; p++) {
+    char quote;
+    char* start;
+    size_t len;
+
+    if (end - p > 5 && strncasecmp(p, "src=", 4) == 0) start = p + 4;
+    else if (end - p > 6 && strncasecmp(p, "href=", 5) == 0) start = p + 5;
+    else continue;
+    quote = *start;
+    if (quote != '"' && quote != '\'') continue;
+    start++;
+    for (len = 0; start + len < end && start[len] != quote; len++);
+    if (start + len >= end || len == 0 || len >= sizeof(link)) continue;
+    safe_strncpy(link, start, len);
+    p = start + len;
+    if (strchr(link, '#')) *strchr(link, '#') = '\0';
+
+    if (strncasecmp(link, "http://", 7) == 0) {
+      /* absolute: must be this host */
+      if (strncasecmp(link + 7, hostname, host_len) != 0 || link[7 + host_len] != '/') continue;
+      strcpy(path, link + 7 + host_len);
+    } else if (link[0] == '/' && link[1] != '/') {
+      strcpy(path, link);
+    } else if (link[0] != '/' && !strchr(link, ':') && dir_len + len < sizeof(path)) {
+      /* relative to the page's directory */
+      safe_strncpy(path, base, dir_len);
+      strcat(path, link);
+    } else {
+      continue;
+    }
+    prefetch_insert(hostname, path);
+    queued++;
+  }
+}
+
+/* add the headers every request needs, returns -1 if one can't be allocated */
+int init_header(Request* req) {
   RequestHeader* find = NULL;
   find = get_header_by_key("Host");
   if (!find){
-    RequestHeader* new_header = Malloc(sizeof(RequestHeader));
-    strcpy(new_header->name, "Host");
-    strcpy(new_header->data, req->hostname);
-    insert_header(new_header);
+    if (!(find = new_header("Host", 4, req->hostname, strlen(req->hostname)))) return -1;
+    insert_header(find);
   }
   find = NULL;
 
   find = get_header_by_key("User-Agent");
   if (!find){
-    RequestHeader* new_header = Malloc(sizeof(RequestHeader));
-    strcpy(new_header->name, "User-Agent");
-    strcpy(new_header->data, user_agent_hdr);
-    insert_header(new_header);
+    if (!(find = new_header("User-Agent", 10, user_agent_hdr, strlen(user_agent_hdr)))) return -1;
+    insert_header(find);
   }
   find = NULL;
 
   find = get_header_by_key("Connection");
   if (!find){
-    RequestHeader* new_header = Malloc(sizeof(RequestHeader));
-    strcpy(new_header->name, "Connection");
-    strcpy(new_header->data, "close");
-    insert_header(new_header);
+    if (!(find = new_header("Connection", 10, "close", strlen("close")))) return -1;
+    insert_header(find);
   }
   find = NULL;
 
   find = get_header_by_key("Proxy-Connection");
   if (!find){
-    RequestHeader* new_header = Malloc(sizeof(RequestHeader));
-    strcpy(new_header->name, "Proxy-Connection");
-    strcpy(new_header->data, "close");
-    insert_header(new_header);
+    if (!(find = new_header("Proxy-Connection", 16, "close", strlen("close")))) return -1;
+    insert_header(find);
   }
   find = NULL;
+  return 0;
 }
 
 /* get header struct with key */
@@ -334,7 +939,7 @@ RequestHeader* get_header_by_key(char* type) {
   RequestHeader* temp; 
   temp = root_header;
   while (temp) {
-    if (strcmp(temp->name, type) == 0) {
+    if (strcasecmp(temp->name, type) == 0) {
       return temp;
     } else {
       temp = temp->next;
@@ -343,9 +948,22 @@ RequestHeader* get_header_by_key(char* type) {
   return NULL;
 }
 
+/* allocate header with name and data stored inline, NULL if out of memory */
+RequestHeader* new_header(const char* name, size_t name_len, const char* data, size_t data_len) {
+  RequestHeader* header = slab_alloc(sizeof(RequestHeader) + name_len + data_len + 2);
+  if (!header) return NULL;
+  header->name = header->buf;
+  header->data = header->buf + name_len + 1;
+  safe_strncpy(header->name, name, name_len);
+  safe_strncpy(header->data, data, data_len);
+  header->next = NULL;
+  return header;
+}
+
 /* insert header to list */
 void insert_header(RequestHeader *header) {
   RequestHeader* last=NULL;
+  if (!header) return;          /* out of memory: drop the header */
   if (!root_header) {
     root_header = header;
     header->next = NULL;
@@ -389,16 +1007,13 @@ void parse_request(Request* req, char* buf) {
 
 /* parse and insert header struct to send to serverfd */
 void parse_header(char *buf) {
-  RequestHeader* header = Malloc(sizeof(RequestHeader));
   char* pname = strstr(buf, ": ");
   char* pdata = strstr(buf, "\r\n");
   if ((!pname)||(!pdata)) {
     printf("bad header format error\n");
     return;
   }
-  safe_strncpy(header->name, buf, pname-buf);
-  safe_strncpy(header->data, pname+2, pdata-pname-2);
-  insert_header(header);
+  insert_header(new_header(buf, pname-buf, pname+2, pdata-pname-2));
 }
 
 /* get last header struct from the list */
@@ -418,12 +1033,12 @@ void free_req_and_header(Request* req, RequestHeader* root_header) {
   if (current) {
     while (current->next) {
       temp = current->next;
-      free(current);
+      slab_free(current);
       current = temp;
     }
-    free(current);
+    slab_free(current);
   }
-  free(req);
+  slab_free(req);
 }
 
 /* copy string safely */
@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+#
+# psibench.py - adaptive cache sizing against a simulated pressure source
+#
+# For a proxy started as "./proxy -a -m <psi file> <port>": writes PSI
+# lines to the file the way /proc/pressure/memory reports them while
+# cycling through more distinct objects than the cache holds, so it
+# keeps evicting below the hit ratio target. Checks from GET /stats that
+# the cache grows while calm, holds under some pressure, shrinks to fit
+# under high pressure and grows again once calm.
+#
+# usage: ./psibench.py <proxy port> <psi file> [-o origin port] [-s seconds]
+#
+import argparse
+import socket
+import sys
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+RATE = 25           # requests per second, under the proxy's CLIENT_RATE
+SETTLE = 1.5        # seconds for the adapt thread to read a new level
+PHASES = [("calm", 0.0, 0, "grow"), ("some", 5.0, 1, "hold"),
+          ("high", 40.0, 2, "shrink"), ("calm", 0.0, 0, "grow")]
+
+
+class Origin(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.0"
+
+    def do_GET(self):
+        size = int(self.path.rsplit("_", 1)[-1])
+        body = (self.path * (size // len(self.path) + 1)).encode()[:size]
+        self.send_response(200)
+        self.send_header("Content-Type", "application/octet-stream")
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def log_message(self, *args):
+        pass
+
+
+def fetch(proxy_port, uri, host=None):
+    s = socket.create_connection(("127.0.0.1", proxy_port))
+    req = "GET %s HTTP/1.0\r\n" % uri
+    if host:
+        req += "Host: %s\r\n" % host
+    s.sendall((req + "\r\n").encode())
+    data = b""
+    while True:
+        chunk = s.recv(65536)
+        if not chunk:
+            break
+        data += chunk
+    s.close()
+    return data
+
+
+def stats(proxy_port):
+    body = fetch(proxy_port, "/stats").split(b"\r\n\r\n", 1)[-1].decode()
+    return dict((k, float(v)) for k, v in (l.split() for l in body.splitlines()))
+
+
+def write_psi(path, avg10):
+    with open(path, "w") as f:
+        f.write("some avg10=%.2f avg60=%.2f avg300=%.2f total=0\n"
+                "full avg10=%.2f avg60=%.2f avg300=%.2f total=0\n"
+                % (avg10, avg10, avg10, avg10 / 2, avg10 / 2, avg10 / 2))
+
+
+def traffic(proxy_port, host, stop):
+    i = n = size = 0
+    while not stop.is_set():
+        # objects of half the current object limit, cycling through four
+        # times the cache so LRU keeps missing
+        if i % RATE == 0:
+            st = stats(proxy_port)
+            size = int(st["max_object_size"]) // 2
+            n = int(st["max_cache_size"]) * 4 // size + 1
+        fetch(proxy_port, "http://%s/obj%d_%d" % (host, i % n, size), host)
+        i += 1
+        time.sleep(1.0 / RATE)
+
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument("proxy_port", type=int)
+    ap.add_argument("psi_file")
+    ap.add_argument("-o", "--origin-port", type=int, default=18192)
+    ap.add_argument("-s", "--seconds", type=float, default=4, help="length of each phase")
+    args = ap.parse_args()
+
+    st = stats(args.proxy_port)
+    if not st["adaptive"]:
+        sys.exit("proxy is not adapting, start it with -a -m %s" % args.psi_file)
+
+    origin = ThreadingHTTPServer(("127.0.0.1", args.origin_port), Origin)
+    threading.Thread(target=origin.serve_forever, daemon=True).start()
+    host = "localhost:%d" % args.origin_port
+    write_psi(args.psi_file, 0.0)
+    stop = threading.Event()
+    threading.Thread(target=traffic, args=(args.proxy_port, host, stop), daemon=True).start()
+
+    failed = 0
+    for name, avg10, level, want in PHASES:
+        write_psi(args.psi_file, avg10)
+        time.sleep(SETTLE)
+        size = stats(args.proxy_port)["max_cache_size"]
+        time.sleep(args.seconds)
+        st = stats(args.proxy_port)
+        new = st["max_cache_size"]
+        ok = {"grow": new > size, "hold": new == size, "shrink": new < size}[want]
+        ok = ok and st["pressure"] == level and st["cache_volume"] <= new
+        print("%-5s avg10=%-5.1f pressure %2d  max_cache_size %8d -> %8d  volume %8d  %s %s"
+              % (name, avg10, st["pressure"], size, new, st["cache_volume"],
+                 want, "ok" if ok else "FAILED"))
+        failed += not ok
+    stop.set()
+    write_psi(args.psi_file, 0.0)
+    origin.shutdown()
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
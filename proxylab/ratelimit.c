@@ -0,0 +1,102 @@
+/*
+ * ratelimit.c - token bucket per client IPv4 address
+ *
+ * Buckets live in a fixed open-addressing table. A slot is claimed by
+ * CAS on its address and a bucket is updated by CAS on one 64-bit word
+ * holding the last refill time (ms) and the token count (milli-tokens),
+ * so no lock is taken on the accept path. Slots whose bucket has been
+ * idle long enough to be full again may be reclaimed for a new client.
+ */
+#include <time.h>
+#include "ratelimit.h"
+
+#define RATE_TABLE_SIZE 4096            /* must be a power of two */
+#define RATE_PROBES     16              /* slots probed before failing open */
+#define TOKEN_BITS      24
+#define TOKEN_MASK      ((1ULL << TOKEN_BITS) - 1)
+#define MILLI           1000ULL
+
+#define PACK_STATE(ms, tokens)  (((uint64_t)(ms) << TOKEN_BITS) | (tokens))
+#define STATE_MS(s)             ((s) >> TOKEN_BITS)
+#define STATE_TOKENS(s)         ((s) & TOKEN_MASK)
+
+typedef struct {
+  volatile uint32_t addr;               /* client address, 0 if unused */
+  volatile uint64_t state;              /* refill time << TOKEN_BITS | tokens */
+} RateBucket;
+
+static RateBucket rate_table[RATE_TABLE_SIZE];
+static uint64_t rate_per_ms;            /* milli-tokens added per ms */
+static uint64_t rate_burst;             /* bucket capacity in milli-tokens */
+static uint64_t rate_idle_ms;           /* time to refill an empty bucket */
+
+static uint64_t now_ms(void);
+static RateBucket *rate_bucket(uint32_t addr, uint64_t now);
+
+/* admit rate connections per second per client, up to burst at once */
+void rate_init(unsigned int rate, unsigned int burst) {
+  rate_per_ms = rate;
+  rate_burst = burst * MILLI;
+  if (rate_burst > TOKEN_MASK) rate_burst = TOKEN_MASK;
+  rate_idle_ms = rate ? rate_burst / rate + 1 : 0;
+}
+
+/* take one token from addr's bucket; returns 1 if the client is admitted */
+int rate_admit(uint32_t addr) {
+  uint64_t now = now_ms();
+  uint64_t old, tokens;
+  RateBucket *b;
+
+  if (!rate_per_ms) return 1;
+  if (!(b = rate_bucket(addr, now))) return 1;
+
+  do {
+    old = b->state;
+    tokens = STATE_TOKENS(old) + (now - STATE_MS(old)) * rate_per_ms;
+    if (tokens > rate_burst) tokens = rate_burst;
+    if (tokens < MILLI) return 0;
+  } while (!__sync_bool_compare_and_swap(&b->state, old,
+                                          PACK_STATE(now, tokens - MILLI)));
+  return 1;
+}
+
+static uint64_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * find or claim the bucket for addr, NULL if the probe window is full;
+ * a bucket already held for addr anywhere in the window is preferred to
+ * a free slot, and losing a race for a slot starts the search over, so
+ * two threads admitting a new client end up sharing one bucket
+ */
+static RateBucket *rate_bucket(uint32_t addr, uint64_t now) {
+  uint32_t h = (addr * 2654435761u) & (RATE_TABLE_SIZE - 1);
+  uint32_t key = addr ? addr : 1;       /* 0 marks an empty slot */
+  uint32_t cur = 0;
+  uint64_t state = 0;
+  RateBucket *b = NULL;
+  int i, tries;
+
+  for (tries = 0; tries < RATE_PROBES; tries++) {
+    for (i = 0; i < RATE_PROBES; i++) {
+      b = &rate_table[(h + i) & (RATE_TABLE_SIZE - 1)];
+      if (b->addr == key) return b;
+    }
+    for (i = 0; i < RATE_PROBES; i++) {
+      b = &rate_table[(h + i) & (RATE_TABLE_SIZE - 1)];
+      cur = b->addr;
+      state = b->state;
+      if (cur == key) return b;
+      if (cur == 0 || now - STATE_MS(state) > rate_idle_ms) break;
+    }
+    if (i == RATE_PROBES) return NULL;
+    /* reset the bucket first so a new owner starts full */
+    if (__sync_bool_compare_and_swap(&b->state, state, PACK_STATE(now, rate_burst)) &&
+        (__sync_bool_compare_and_swap(&b->addr, cur, key) || b->addr == key))
+      return b;
+  }
+  return NULL;
+}
@@ -0,0 +1,12 @@
+/*
+ * ratelimit.h - per-client token buckets for connection admission
+ */
+#ifndef __RATELIMIT_H__
+#define __RATELIMIT_H__
+
+#include <stdint.h>
+
+void rate_init(unsigned int rate, unsigned int burst);
+int rate_admit(uint32_t addr);
+
+#endif /* __RATELIMIT_H__ */
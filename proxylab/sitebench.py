@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+#
+# sitebench.py - page-load miss counts through the proxy
+#
+# Serves a synthetic site from a local origin (each page links shared
+# and page-specific sub-resources), loads every page through the proxy
+# the way an HTTP/1.0 browser would (page, then each src= resource in
+# order) and reports origin misses and load time per page, read from
+# the proxy's GET /stats counters.
+#
+# usage: ./sitebench.py <proxy port> [-o origin port] [-n pages] [-d delay ms]
+#
+import argparse
+import re
+import socket
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+RESOURCES_PER_PAGE = 8
+delay = 0.02
+
+
+def page_html(i, port):
+    host = "localhost:%d" % port
+    imgs = "".join('<img src="img/p%d_%d.png">' % (i, k)
+                   for k in range(RESOURCES_PER_PAGE))
+    return ('<html><head><link href="/static/common.css" rel="stylesheet">'
+            '<script src="http://%s/static/app.js"></script></head><body>'
+            '%s<a href="http://example.com/">elsewhere</a>'
+            '<a href="/page%d.html">next</a></body></html>' % (host, imgs, i + 1))
+
+
+class Origin(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.0"
+
+    def do_GET(self):
+        time.sleep(delay)
+        m = re.match(r"^/page(\d+)\.html$", self.path)
+        if m:
+            body = page_html(int(m.group(1)), self.server.server_port).encode()
+            ctype = "text/html"
+        else:
+            body = (self.path * 64).encode()[:2048]
+            ctype = "application/octet-stream"
+        self.send_response(200)
+        self.send_header("Content-Type", ctype)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def log_message(self, *args):
+        pass
+
+
+def fetch(proxy_port, uri, host=None):
+    s = socket.create_connection(("127.0.0.1", proxy_port))
+    req = "GET %s HTTP/1.0\r\n" % uri
+    if host:
+        req += "Host: %s\r\n" % host
+    s.sendall((req + "\r\n").encode())
+    data = b""
+    while True:
+        chunk = s.recv(65536)
+        if not chunk:
+            break
+        data += chunk
+    s.close()
+    return data
+
+
+def stats(proxy_port):
+    body = fetch(proxy_port, "/stats").split(b"\r\n\r\n", 1)[-1].decode()
+    return dict((k, float(v)) for k, v in (l.split() for l in body.splitlines()))
+
+
+def main():
+    global delay
+    ap = argparse.ArgumentParser()
+    ap.add_argument("proxy_port", type=int)
+    ap.add_argument("-o", "--origin-port", type=int, default=18190)
+    ap.add_argument("-n", "--pages", type=int, default=20)
+    ap.add_argument("-d", "--delay", type=float, default=20, help="origin delay in ms")
+    args = ap.parse_args()
+    delay = args.delay / 1000.0
+
+    origin = ThreadingHTTPServer(("127.0.0.1", args.origin_port), Origin)
+    threading.Thread(target=origin.serve_forever, daemon=True).start()
+    host = "localhost:%d" % args.origin_port
+
+    before = stats(args.proxy_port)
+    start = time.time()
+    for i in range(args.pages):
+        page = "http://%s/page%d.html" % (host, i)
+        html = fetch(args.proxy_port, page, host).decode(errors="replace")
+        for src in re.findall(r'src="([^"]+)"', html):
+            if not src.startswith("http://"):
+                src = "http://%s/%s" % (host, src.lstrip("/"))
+            fetch(args.proxy_port, src, host)
+    elapsed = time.time() - start
+    after = stats(args.proxy_port)
+    origin.shutdown()
+
+    requests = args.pages * (RESOURCES_PER_PAGE + 2)
+    misses = after["misses"] - before["misses"]
+    print("pages %d, requests %d, misses %d (%.2f per page), hits %d, prefetched %d"
+          % (args.pages, requests, misses, misses / args.pages,
+             after["hits"] - before["hits"], after["prefetched"] - before["prefetched"]))
+    print("page load %.1f ms average" % (elapsed * 1000 / args.pages))
+
+
+if __name__ == "__main__":
+    main()
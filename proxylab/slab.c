@@ -0,0 +1,332 @@
+/*
+ * slab.c - size-classed slab pools for the proxy
+ *
+ * Memory is taken from the OS in SLAB_SIZE-aligned slabs. Each slab
+ * holds objects of a single size class, and its header records that
+ * class, so slab_free() finds the owner by masking the pointer. A slab
+ * is mapped only as long as its objects need, and keeps its own free
+ * list and count of objects out; a slab whose objects all come back is
+ * unmapped, except for one spare per class. Each thread keeps a small
+ * cache of free objects per class and only takes the class lock to move
+ * objects in batches. Requests larger than the largest class get a
+ * dedicated aligned mapping with the same header.
+ */
+#include <stdint.h>
+#include "csapp.h"
+#include "slab.h"
+
+#define SLAB_SIZE     (1 << 18)         /* slab size and alignment */
+#define SLAB_HDR      64                /* header room, keeps objects aligned */
+#define SLAB_MAGIC    0x51ab51ab
+#define MIN_CLASS     16
+#define MAX_CLASS     (128 * 1024)      /* larger requests are mapped alone */
+#define MAX_CLASSES   64
+#define TCACHE_MAX    32                /* free objects a thread may keep */
+#define TCACHE_BYTES  (64 * 1024)       /* ... but no more bytes than this */
+
+#define MAX(x, y)   ((x) > (y) ? (x) : (y))
+#define SLAB_OF(p)  ((slab_t *)((uintptr_t)(p) & ~(uintptr_t)(SLAB_SIZE - 1)))
+
+typedef struct free_obj {
+  struct free_obj *next;
+} free_obj;
+
+/* slab header, placed at the aligned start of every slab */
+typedef struct slab {
+  unsigned int magic;
+  int cls;                /* size class index, -1 for a large object */
+  size_t size;            /* usable bytes per object */
+  size_t map_size;        /* bytes mapped for this slab */
+  free_obj *free;         /* objects given back to this slab */
+  struct slab *prev;      /* neighbours on the class partial list */
+  struct slab *next;
+  int out;                /* objects carved and not given back */
+} slab_t;
+
+/* global pool of one size class */
+typedef struct {
+  size_t size;
+  size_t slab_size;       /* bytes mapped per slab */
+  int tcache_max;         /* thread cache limit for this class */
+  sem_t mutex;
+  slab_t *partial;        /* slabs with objects on their free list */
+  slab_t *top;            /* newest slab, still being carved */
+  char *bump;             /* uncarved tail of the newest slab */
+  char *bump_end;
+  int empty;              /* slabs on the partial list with nothing out */
+} slab_class;
+
+/* per-thread cache of one size class */
+typedef struct {
+  free_obj *head;
+  int count;
+} tcache_bin;
+
+static slab_class classes[MAX_CLASSES];
+static int nclasses = 0;
+static size_t footprint = 0;            /* bytes currently mapped */
+static pthread_key_t tcache_key;
+
+static __thread tcache_bin tcache[MAX_CLASSES];
+static __thread int tcache_live = 0;
+
+static void *map_aligned(size_t size);
+static int size_class(size_t size);
+static void tcache_fill(int cls);
+static void tcache_flush(int cls, int n);
+static void tcache_destroy(void *unused);
+static void partial_remove(slab_class *c, slab_t *slab);
+static void slab_unmap(slab_class *c, slab_t *slab);
+
+/* build the size class table and the thread cache destructor */
+void slab_init(void) {
+  size_t size = MIN_CLASS;
+  size_t pow2;
+
+  while (size <= MAX_CLASS && nclasses < MAX_CLASSES) {
+    size_t per_slab = (SLAB_SIZE - SLAB_HDR) / size;
+    classes[nclasses].size = size;
+    classes[nclasses].slab_size = (SLAB_HDR + per_slab * size + getpagesize() - 1) &
+                                  ~((size_t)getpagesize() - 1);
+    classes[nclasses].tcache_max = size * TCACHE_MAX <= TCACHE_BYTES ?
+                                   TCACHE_MAX : MAX(TCACHE_BYTES / size, 1);
+    classes[nclasses].partial = classes[nclasses].top = NULL;
+    classes[nclasses].bump = classes[nclasses].bump_end = NULL;
+    classes[nclasses].empty = 0;
+    Sem_init(&classes[nclasses].mutex, 0, 1);
+    nclasses++;
+    /* 16-byte steps up to 64, then four classes per power of two */
+    if (size < 64) {
+      size += MIN_CLASS;
+    } else {
+      for (pow2 = 64; pow2 * 2 <= size; pow2 *= 2);
+      size += pow2 / 4;
+    }
+  }
+  pthread_key_create(&tcache_key, tcache_destroy);
+}
+
+/* allocate size bytes from the matching class */
+void *slab_alloc(size_t size) {
+  tcache_bin *bin;
+  free_obj *obj;
+  slab_t *slab;
+  int cls;
+
+  if (size == 0) size = 1;
+  if (size > MAX_CLASS) {
+    size_t map_size = (SLAB_HDR + size + getpagesize() - 1) & ~((size_t)getpagesize() - 1);
+    if ((slab = map_aligned(map_size)) == NULL) return NULL;
+    slab->magic = SLAB_MAGIC;
+    slab->cls = -1;
+    slab->size = map_size - SLAB_HDR;
+    slab->map_size = map_size;
+    return (char *)slab + SLAB_HDR;
+  }
+
+  cls = size_class(size);
+  bin = &tcache[cls];
+  if (!bin->head) {
+    tcache_fill(cls);
+    if (!bin->head) return NULL;
+  }
+  obj = bin->head;
+  bin->head = obj->next;
+  bin->count--;
+  return obj;
+}
+
+/* allocate zero-filled memory */
+void *slab_calloc(size_t size) {
+  void *ptr = slab_alloc(size);
+  if (ptr) memset(ptr, 0, size);
+  return ptr;
+}
+
+/* return ptr to the current thread's cache, or unmap a large object */
+void slab_free(void *ptr) {
+  slab_t *slab;
+  tcache_bin *bin;
+  free_obj *obj = ptr;
+
+  if (!ptr) return;
+  slab = SLAB_OF(ptr);
+  if (slab->cls < 0) {
+    __sync_fetch_and_sub(&footprint, slab->map_size);
+    munmap(slab, slab->map_size);
+    return;
+  }
+  bin = &tcache[slab->cls];
+  obj->next = bin->head;
+  bin->head = obj;
+  if (++bin->count > classes[slab->cls].tcache_max)
+    tcache_flush(slab->cls, (bin->count + 1) / 2);
+}
+
+/* bytes actually reserved for ptr */
+size_t slab_usable_size(void *ptr) {
+  return SLAB_OF(ptr)->size;
+}
+
+/* bytes currently mapped from the OS */
+size_t slab_footprint(void) {
+  return footprint;
+}
+
+/*
+ * give the calling thread's cached objects back and unmap every slab
+ * left with nothing out, spares included
+ */
+void slab_trim(void) {
+  slab_class *c;
+  slab_t *slab, *next;
+  int i;
+
+  for (i = 0; i < nclasses; i++) {
+    c = &classes[i];
+    if (tcache[i].head) tcache_flush(i, tcache[i].count);
+    P(&c->mutex);
+    for (slab = c->partial; slab && c->empty; slab = next) {
+      next = slab->next;
+      if (slab->out) continue;
+      partial_remove(c, slab);
+      c->empty--;
+      slab_unmap(c, slab);
+    }
+    V(&c->mutex);
+  }
+}
+
+/* map size bytes aligned to SLAB_SIZE */
+static void *map_aligned(size_t size) {
+  char *raw, *base;
+  size_t tail;
+
+  raw = mmap(NULL, size + SLAB_SIZE, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (raw == MAP_FAILED) return NULL;
+  base = (char *)SLAB_OF(raw + SLAB_SIZE - 1);
+  if (base > raw) munmap(raw, base - raw);
+  tail = (raw + size + SLAB_SIZE) - (base + size);
+  if (tail) munmap(base + size, tail);
+  __sync_fetch_and_add(&footprint, size);
+  return base;
+}
+
+/* smallest class that fits size */
+static int size_class(size_t size) {
+  int lo = 0, hi = nclasses - 1;
+
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (classes[mid].size < size) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+/*
+ * move a batch of objects from the class pool; objects are carved from
+ * the newest slab only when handed out, so untouched pages stay unmapped
+ */
+static void tcache_fill(int cls) {
+  slab_class *c = &classes[cls];
+  tcache_bin *bin = &tcache[cls];
+  free_obj *obj;
+  slab_t *slab;
+  int n;
+
+  if (!tcache_live) {
+    tcache_live = 1;
+    pthread_setspecific(tcache_key, (void *)1);
+  }
+
+  P(&c->mutex);
+  for (n = 0; n < (c->tcache_max + 1) / 2; n++) {
+    if ((slab = c->partial)) {
+      obj = slab->free;
+      if (!(slab->free = obj->next)) partial_remove(c, slab);
+      if (slab->out++ == 0) c->empty--;
+    } else {
+      if (c->bump + c->size > c->bump_end) {
+        if (!(slab = map_aligned(c->slab_size))) break;
+        slab->magic = SLAB_MAGIC;
+        slab->cls = cls;
+        slab->size = c->size;
+        slab->map_size = c->slab_size;
+        slab->free = NULL;
+        slab->out = 0;
+        c->top = slab;
+        c->bump = (char *)slab + SLAB_HDR;
+        c->bump_end = (char *)slab + c->slab_size;
+      }
+      obj = (free_obj *)c->bump;
+      c->bump += c->size;
+      c->top->out++;
+    }
+    obj->next = bin->head;
+    bin->head = obj;
+    bin->count++;
+  }
+  V(&c->mutex);
+}
+
+/*
+ * give n objects of a thread cache back to their slabs; a slab with
+ * nothing left out is kept as the class's spare if it has none, and
+ * unmapped otherwise
+ */
+static void tcache_flush(int cls, int n) {
+  slab_class *c = &classes[cls];
+  tcache_bin *bin = &tcache[cls];
+  free_obj *obj;
+  slab_t *slab;
+
+  P(&c->mutex);
+  while (n-- > 0 && bin->head) {
+    obj = bin->head;
+    bin->head = obj->next;
+    bin->count--;
+    slab = SLAB_OF(obj);
+    if (!slab->free) {
+      slab->prev = NULL;
+      slab->next = c->partial;
+      if (c->partial) c->partial->prev = slab;
+      c->partial = slab;
+    }
+    obj->next = slab->free;
+    slab->free = obj;
+    if (--slab->out == 0) {
+      if (c->empty == 0) {
+        c->empty = 1;           /* keep it as the spare */
+      } else {
+        partial_remove(c, slab);
+        slab_unmap(c, slab);
+      }
+    }
+  }
+  V(&c->mutex);
+}
+
+/* unlink a slab from the class partial list, class mutex held */
+static void partial_remove(slab_class *c, slab_t *slab) {
+  if (slab->prev) slab->prev->next = slab->next;
+  else c->partial = slab->next;
+  if (slab->next) slab->next->prev = slab->prev;
+}
+
+/* give a slab with nothing out back to the OS, class mutex held */
+static void slab_unmap(slab_class *c, slab_t *slab) {
+  if (slab == c->top) {
+    c->top = NULL;
+    c->bump = c->bump_end = NULL;
+  }
+  __sync_fetch_and_sub(&footprint, slab->map_size);
+  munmap(slab, slab->map_size);
+}
+
+/* thread exit: nothing may stay behind in a dead thread's cache */
+static void tcache_destroy(void *unused) {
+  slab_trim();
+  tcache_live = 0;
+}
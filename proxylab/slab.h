@@ -0,0 +1,18 @@
+/*
+ * slab.h - size-classed slab pools for the proxy's cache entries and
+ *          per-connection structures
+ */
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include <stddef.h>
+
+void slab_init(void);
+void *slab_alloc(size_t size);
+void *slab_calloc(size_t size);
+void slab_free(void *ptr);
+size_t slab_usable_size(void *ptr);
+size_t slab_footprint(void);
+void slab_trim(void);
+
+#endif /* __SLAB_H__ */
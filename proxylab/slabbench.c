@@ -0,0 +1,179 @@
+/*
+ * slabbench.c - replay the proxy's allocation pattern against glibc
+ *               malloc (the old fixed-size layout) or the slab pools,
+ *               then empty the cache and report what RSS drops back to
+ *
+ * usage: ./slabbench [-m] [-t threads] [-n connections] [-c cache bytes]
+ *   -m  use malloc with the old Request/RequestHeader/CachedItem sizes
+ */
+#include <malloc.h>
+#include "csapp.h"
+#include "slab.h"
+
+#define MAX_CACHE_SIZE 1049000
+#define MAX_OBJECT_SIZE 102400
+#define HEADERS 6
+
+#define OLD_REQUEST     1610
+#define OLD_HEADER      (2 * MAXLINE + sizeof(void *))
+#define OLD_ITEM        1232
+
+typedef struct item {
+  struct item *next;
+  size_t charge;
+  void *data;                 /* separate data block in malloc mode */
+} item;
+
+static int use_malloc = 0;
+static int connections = 200000;
+static size_t cache_size = MAX_CACHE_SIZE;
+static sem_t cache_mutex;
+static item *cache_head = NULL, *cache_tail = NULL;
+static size_t cache_volume = 0;
+
+static void *bench_alloc(size_t size) {
+  return use_malloc ? malloc(size) : slab_alloc(size);
+}
+
+static void bench_free(void *ptr) {
+  if (use_malloc) free(ptr);
+  else slab_free(ptr);
+}
+
+/* insert an object of size bytes, evicting the oldest while over budget */
+static void cache_insert(size_t size, unsigned int *seed) {
+  item *it;
+
+  if (use_malloc) {
+    it = malloc(OLD_ITEM);
+    it->data = malloc(size);
+    it->charge = size;
+  } else {
+    it = slab_alloc(sizeof(item) + 64 + size);
+    it->data = NULL;
+    it->charge = slab_usable_size(it);
+  }
+  memset(use_malloc ? it->data : (void *)(it + 1), 'x', size);  /* store the response */
+  it->next = NULL;
+
+  P(&cache_mutex);
+  while (cache_head && cache_volume + it->charge > cache_size) {
+    item *victim = cache_head;
+    cache_head = victim->next;
+    if (!cache_head) cache_tail = NULL;
+    cache_volume -= victim->charge;
+    if (use_malloc) {
+      free(victim->data);
+      free(victim);
+    } else {
+      slab_free(victim);
+    }
+  }
+  if (cache_tail) cache_tail->next = it;
+  else cache_head = it;
+  cache_tail = it;
+  cache_volume += it->charge;
+  V(&cache_mutex);
+}
+
+/* one thread serving connections back to back */
+static void *worker(void *vargp) {
+  unsigned int seed = (unsigned int)(long)vargp;
+  void *headers[HEADERS];
+  void *req;
+  int i, j;
+
+  for (i = 0; i < connections; i++) {
+    req = bench_alloc(OLD_REQUEST);
+    for (j = 0; j < HEADERS; j++)
+      headers[j] = bench_alloc(use_malloc ? OLD_HEADER : 32 + rand_r(&seed) % 96);
+    if (rand_r(&seed) % 2)
+      cache_insert(1 + (rand_r(&seed) % 8 ? rand_r(&seed) % 8192 : rand_r(&seed) % MAX_OBJECT_SIZE), &seed);
+    for (j = 0; j < HEADERS; j++)
+      bench_free(headers[j]);
+    bench_free(req);
+  }
+  return NULL;
+}
+
+/* read a kB field such as VmRSS or VmHWM from /proc/self/status */
+static long status_kb(const char *field) {
+  char line[256];
+  long kb = -1;
+  FILE *fp = fopen("/proc/self/status", "r");
+
+  if (!fp) return -1;
+  while (fgets(line, sizeof(line), fp)) {
+    if (!strncmp(line, field, strlen(field))) {
+      sscanf(line + strlen(field) + 1, "%ld", &kb);
+      break;
+    }
+  }
+  fclose(fp);
+  return kb;
+}
+
+/* evict everything, as the adapt thread does when it shrinks the cache */
+static void cache_drain(void) {
+  item *victim;
+
+  while ((victim = cache_head)) {
+    cache_head = victim->next;
+    if (use_malloc) {
+      free(victim->data);
+      free(victim);
+    } else {
+      slab_free(victim);
+    }
+  }
+  cache_tail = NULL;
+  cache_volume = 0;
+}
+
+int main(int argc, char **argv) {
+  int nthreads = 4;
+  int c, i;
+  pthread_t *tids;
+  struct timeval start, end;
+  double secs;
+
+  while ((c = getopt(argc, argv, "mt:n:c:")) != -1) {
+    switch (c) {
+    case 'm': use_malloc = 1; break;
+    case 't': nthreads = atoi(optarg); break;
+    case 'n': connections = atoi(optarg); break;
+    case 'c': cache_size = atol(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s [-m] [-t threads] [-n connections] [-c cache bytes]\n", argv[0]);
+      exit(1);
+    }
+  }
+
+  slab_init();
+  Sem_init(&cache_mutex, 0, 1);
+  tids = Malloc(nthreads * sizeof(pthread_t));
+
+  gettimeofday(&start, NULL);
+  for (i = 0; i < nthreads; i++)
+    Pthread_create(&tids[i], NULL, worker, (void *)(long)(i + 1));
+  for (i = 0; i < nthreads; i++)
+    Pthread_join(tids[i], NULL);
+  gettimeofday(&end, NULL);
+  secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+
+  printf("%s: %d threads x %d connections\n",
+         use_malloc ? "malloc" : "slab", nthreads, connections);
+  printf("  throughput  %.0f Kconn/s (%.0f Kallocs/s)\n",
+         nthreads * connections / secs / 1e3,
+         nthreads * connections * (HEADERS + 1.5) / secs / 1e3);
+  printf("  rss         %ld kB (peak %ld kB)\n", status_kb("VmRSS"), status_kb("VmHWM"));
+  printf("  cache       %zu bytes charged\n", cache_volume);
+  cache_drain();
+  if (use_malloc) malloc_trim(0);
+  else slab_trim();
+
+  printf("  drained     rss %ld kB", status_kb("VmRSS"));
+  if (!use_malloc) printf(", %zu kB mapped", slab_footprint() / 1024);
+  printf("\n");
+  return 0;
+}